@@ -0,0 +1,74 @@
+/*
+ * Checks that a knob bound to a setting keeps a value which the application
+ * has set with settingsSet(), and still applies the turns of the knob.
+ * The detents are given with knob.turn(), so no encoder is needed. The
+ * results are printed on the serial port.
+ */
+
+#include <ST7735_t3.h>
+#include <settings.h>
+#include <settings_knob.h>
+
+#define TFT_CS 10
+#define TFT_DC 9
+#define TFT_RST 8
+
+ST7735_t3 tft = ST7735_t3( TFT_CS, TFT_DC, TFT_RST );
+SettingsKnob knob;
+Setting *filter;
+char *filterValues[] = { "2.4k", "1.8k", "1.2k", "500", "250" };
+
+
+bool changeFilter( Setting *setting ) {
+  return true;
+}
+
+
+/**
+ * Prints the result of a check.
+ */
+bool check( const char *what, bool passed ) {
+  Serial.print( passed ? "PASS " : "FAIL " );
+  Serial.println( what );
+  return passed;
+}
+
+
+/**
+ * Polls the knob until a value without liveUpdate has been applied.
+ */
+void settle() {
+  knob.poll();
+  delay( KNOB_SETTLE + 10 );
+  knob.poll();
+}
+
+
+void setup() {
+  bool result = true;
+  Serial.begin( 9600 );
+  delay( 2000 );
+  tft.initR( INITR_BLACKTAB );
+  initSettings( 1, &tft );
+  filter = createSetting( "Filter", filterValues, 5, 0, false, changeFilter );
+  knob.init( filter );
+
+  knob.turn( 1 );
+  settle();
+  result = check( "a turn is applied", filter->currentValue == 1 ) && result;
+
+  // e.g. a CAT command
+  settingsSet( filter, 4, false );
+  settle();
+  result = check( "a value set by the application is kept", filter->currentValue == 4 ) && result;
+
+  knob.turn( -1 );
+  settle();
+  result = check( "a turn starts from the value set", filter->currentValue == 3 ) && result;
+
+  Serial.println( result ? "All checks passed" : "Some checks failed" );
+}
+
+
+void loop() {
+}
@@ -19,15 +19,131 @@
 #include "st7735_properties.h"
 
 
-bool canUseDisplay = false;
-ST7735_t3 *myTFT;
-int maxSettings = 0;  // The maximum allowed number of settings.
-int nSettings = 0;  // The number of Setting's in 'settings'.
-Setting *settings = NULL; // the array of Setting's
-int currentSetting = 0; // index of the currently selected setting
-int topSetting;   // the topmost setting which is currently displayed.
-bool editing = false; // the currently selected setting is being edited now
+// The menu used by the functions outside of SettingsMenu
+SettingsMenu settingsMenu;
 
+// Per setting marks, used to walk the dependencies
+#define MARK_CHANGED 0x01
+#define MARK_VISITED 0x02
+
+// Layout of a line of the menu: selection, name, value
+#define NAME_COLUMN 2
+#define VALUE_CHARS 7     // the value is right aligned in the last VALUE_CHARS columns
+
+#ifdef SETTINGS_STATS
+#define STATS_ADD( counter, n ) (statistics.counter += (n))
+#define STATS_START( start ) unsigned long start = micros()
+#define STATS_TIME( counter, start ) (statistics.counter += micros() - (start))
+#else
+#define STATS_ADD( counter, n )
+#define STATS_START( start )
+#define STATS_TIME( counter, start )
+#endif
+
+#ifdef SETTINGS_LATENCY
+#define LATENCY_START() latencyStart()
+#define LATENCY_END( event ) latencyEnd( event )
+#define LATENCY_DRAWN() (drawn = true, drawnMicros = micros())
+#else
+#define LATENCY_START()
+#define LATENCY_END( event )
+#define LATENCY_DRAWN()
+#endif
+
+#ifdef SETTINGS_TRACE
+// Calls to the library have an upper case op, drawing a lower case op
+#define TRACE_UP 'U'
+#define TRACE_DOWN 'D'
+#define TRACE_OK 'O'
+#define TRACE_STOP 'S'
+#define TRACE_DISPLAY_ON 'N'
+#define TRACE_DISPLAY_OFF 'F'
+#define TRACE_DISPLAY_RESUME 'R'
+#define TRACE_FILL_SCREEN 's'
+#define TRACE_FILL_RECT 'r'
+#define TRACE_PRINT 'p'
+#define TRACE_STATE 'T'
+
+#define TRACE( op, x, y, w, h, color, text ) traceRecord( op, x, y, w, h, color, text, 0 )
+#define TRACE_STRING( op, x, y, w, h, color, text, length ) traceRecord( op, x, y, w, h, color, text, length )
+#define TRACE_CALL( op ) traceRecord( op, 0, 0, 0, 0, 0, NULL, 0 )
+#else
+#define TRACE( op, x, y, w, h, color, text )
+#define TRACE_STRING( op, x, y, w, h, color, text, length )
+#define TRACE_CALL( op )
+#endif
+
+#ifdef SETTINGS_SCREEN
+#define SCREEN_FILL( x, y, w, h ) screenFill( x, y, w, h )
+#define SCREEN_PRINT( x, y, leading, text, length, color ) screenPrint( x, y, leading, text, length, color )
+#else
+#define SCREEN_FILL( x, y, w, h )
+#define SCREEN_PRINT( x, y, leading, text, length, color )
+#endif
+
+
+
+/**
+ * Create an empty menu. It must be initialised with init() before use.
+ */
+SettingsMenu::SettingsMenu() {
+  canUseDisplay = false;
+  stale = true;
+  staleRows = 0;
+  myTFT = NULL;
+  maxSettings = 0;
+  nSettings = 0;
+  settings = NULL;
+  currentSetting = 0;
+  topSetting = 0;
+  winX = 0;
+  winY = 0;
+  winW = TFT_CHARS;
+  winH = TFT_LINES;
+  quick = false;
+  repaintFPtr = NULL;
+  telemetryMillis = TELEMETRY_INTERVAL;
+  lastTelemetry = 0;
+  editing = false;
+  batch = false;
+  batchFPtr = NULL;
+  changeSet = NULL;
+  nDependencies = 0;
+  marks = NULL;
+  order = NULL;
+  nOrder = 0;
+  nListeners = 0;
+  nameIndex = NULL;
+  nNameIndex = 0;
+  valueIndex = NULL;
+  nValueIndex = 0;
+  nIndexed = 0;
+  indexedSettings = 0;
+  for( int e=0; e<PROVIDER_CACHE; e++ )
+    cache[e].setting = -1;
+#ifdef SETTINGS_TIMING
+  timings = NULL;
+#endif
+#ifdef SETTINGS_STATS
+  statsReset();
+#endif
+#ifdef SETTINGS_LATENCY
+  latencyReset();
+  eventStart = 0;
+  stamped = false;
+  drawn = false;
+  drawnMicros = 0;
+#endif
+#ifdef SETTINGS_TRACE
+  trace = NULL;
+  for( int s=0; s<2; s++ )
+    traceStates[s].values = NULL;
+  traceClear();
+#endif
+#ifdef SETTINGS_SCREEN
+  screenFill( 0, 0, TFT_CHARS, TFT_LINES );
+#endif
+}
 
 
 /**
@@ -49,7 +165,7 @@ bool editing = false; // the currently selected setting is being edited now
  * when the number of settings is larger than the maximum number of settings
  * given in 'initSettings()'.
  */
-Setting *createSetting( char *text, char **values, int nValues, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr ) {
+Setting *SettingsMenu::createSetting( char *text, char **values, int nValues, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr ) {
   Setting *setting = NULL;
   if( nSettings == maxSettings )
     return setting;
@@ -60,368 +176,2317 @@ Setting *createSetting( char *text, char **values, int nValues, int currentValue
   setting->currentValue = currentValue;
   setting->newValue = currentValue;
   setting->fPtr = (void *) setFPtr;
+  setting->canFPtr = NULL;
+  setting->refreshFPtr = NULL;
+  setting->getFPtr = NULL;
+  setting->provider = NULL;
   setting->liveUpdate = liveUpdate;
+  setting->can = true;
+  setting->pending = false;
+  // add the name to the index
+  if( text != NULL && nameIndex != NULL ) {
+    unsigned long hash = settingsHash( text );
+    int slot = hash & (nNameIndex - 1);
+    while( nameIndex[slot].setting >= 0 )
+      slot = (slot + 1) & (nNameIndex - 1);
+    nameIndex[slot].hash = hash;
+    nameIndex[slot].setting = nSettings;
+    nameIndex[slot].value = 0;
+  }
+  // add the values to the index, as long as there is room for all of them
+  if( valueIndex != NULL && indexedSettings == nSettings && 2 * (nIndexed + nValues) <= nValueIndex ) {
+    for( int v=0; text != NULL && values != NULL && v<nValues; v++ ) {
+      // the same value of different settings goes into different slots
+      unsigned long hash = settingsHash( values[v] );
+      int slot = (hash + nSettings * 2654435761UL) & (nValueIndex - 1);
+      while( valueIndex[slot].setting >= 0 )
+        slot = (slot + 1) & (nValueIndex - 1);
+      valueIndex[slot].hash = hash;
+      valueIndex[slot].setting = nSettings;
+      valueIndex[slot].value = v;
+    }
+    nIndexed += nValues;
+    indexedSettings++;
+  }
   nSettings++;
   return setting;
 }
 
 
 /**
- * Call to initialise the settings library.
+ * createProvidedSetting
  * 
- * Parameters:
- * n:         max number of settings which can be used.
- * tft:       The display which can be used. The display should already 
- *            be initialised.
+ * Will create a setting of which the values are given by the functions
+ * in 'provider'.
  */
-bool initSettings( int n, ST7735_t3 *tft ) {
-  bool result = true;
-  myTFT = tft;
-  maxSettings = n;
-  settings = (Setting *) malloc( sizeof( Setting ) * n );
-  result = result && (settings != NULL);
-  return result;
+Setting *SettingsMenu::createProvidedSetting( char *text, const ValueProvider *provider, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr ) {
+  if( text == NULL || provider == NULL || provider->countFPtr == NULL || provider->textFPtr == NULL )
+    return NULL;
+  Setting *setting = createSetting( text, NULL, 0, currentValue, liveUpdate, setFPtr );
+  if( setting == NULL )
+    return setting;
+  setting->provider = provider;
+  valuesChanged( setting );
+  return setting;
 }
 
 
 /**
+ * settingsValuesChanged
  * 
+ * The values of provided setting 'setting' have changed.
  */
-bool printAt( int x, int y, char *text, bool clean, int colorFG, int colorBG, int leading ) {
-  bool result = true;
-  if( !canUseDisplay )
-    return result;
-  int col = x * CHAR_WIDTH;
-  int row = y * CHAR_HEIGHT;
-  if ( clean )
-    myTFT->fillRect( col, row, (strlen( text ) + leading) * CHAR_WIDTH, CHAR_HEIGHT, colorBG );
-  if( text != NULL ) {
-    myTFT->setCursor( col, row );
-    myTFT->setTextColor( colorFG );
-    for( int i=0; i<leading; i++ )
-      myTFT->print( " " );
-    myTFT->print( text );
+bool SettingsMenu::valuesChanged( Setting *setting ) {
+  int i = index( setting );
+  if( i < 0 || setting->provider == NULL )
+    return false;
+  setting->nValues = setting->provider->countFPtr( setting );
+  if( setting->nValues < 0 )
+    setting->nValues = 0;
+  int oldValue = setting->currentValue;
+  if( setting->currentValue >= setting->nValues )
+    setting->currentValue = setting->nValues > 0 ? setting->nValues - 1 : 0;
+  if( setting->newValue >= setting->nValues )
+    setting->newValue = setting->currentValue;
+  for( int e=0; e<PROVIDER_CACHE; e++ )
+    if( cache[e].setting == i )
+      cache[e].setting = -1;
+  bool result = redisplayValue( i );
+  // a current value which no longer exists has been changed
+  if( setting->currentValue != oldValue ) {
+    notifyChange( i, oldValue, setting->currentValue, true, CHANGE_LIMIT );
+    result = settingChanged( i ) && result;
   }
   return result;
 }
 
 
-
-/*
-012345....0....5....0....5.
-> SAMPLERATE       96000
-  IF               5000
-  INTERMED FREQ
-  OUT FILTER MAX
-  OUT FILTER TAPS
+/**
+ * Return:
+ * The text of value 'value' of setting 'i', or "" if there is no such value.
+ * The text of a provided setting is kept in a small cache, and may be
+ * replaced by the next call; copy it to keep it.
  */
+const char *SettingsMenu::valueText( int i, int value ) {
+  if( i < 0 || i >= nSettings || value < 0 || value >= settings[i].nValues )
+    return "";
+  Setting *setting = &settings[i];
+  if( setting->provider == NULL )
+    return setting->values[value];
+  // the values around the value being shown are in different entries
+  ValueCache *entry = &cache[value % PROVIDER_CACHE];
+  if( entry->setting != i || entry->value != value ) {
+    entry->setting = i;
+    entry->value = value;
+    if( !setting->provider->textFPtr( setting, value, entry->text, PROVIDER_TEXT ) )
+      entry->text[0] = '\0';
+    entry->text[PROVIDER_TEXT - 1] = '\0';
+  }
+  return entry->text;
+}
 
 
 /**
+ * createTelemetry
  * 
+ * Will create a read-only setting, of which the value is given by 'getFPtr'.
+ * The setting has one value, the text of which is kept after 'values'.
  */
-bool displayName( int i, int row, bool clean, int colorFG, int colorBG ) {
-  bool result = true;
-  if( settings == NULL )
-    return false;
-  result = result && printAt( 2, row, settings[i].name, clean, colorFG, colorBG, 0 );
-  return result;
+Setting *SettingsMenu::createTelemetry( char *text, TelemetryFDef getFPtr ) {
+  if( text == NULL || getFPtr == NULL || nSettings == maxSettings )
+    return NULL;
+  char **values = (char **) malloc( sizeof( char * ) + TELEMETRY_TEXT );
+  if( values == NULL )
+    return NULL;
+  values[0] = (char *) (values + 1);
+  values[0][0] = '\0';
+  Setting *setting = createSetting( text, values, 1, 0, false, NULL );
+  setting->getFPtr = (void *) getFPtr;
+  return setting;
 }
 
 
 /**
+ * settingsTelemetryInterval
  * 
+ * Sets the time between updates of the read-only settings.
  */
-bool displayValue( int i, int row, bool clean, int colorFG, int colorBG ) {
-  bool result = true;
-  if( settings == NULL )
-    return false;
-  int actual = settings[i].newValue;
-  result = result && printAt( 19, row, settings[i].values[actual], clean, colorFG, colorBG, TFT_CHARS - 19 - strlen(settings[i].values[actual]) );
-  return result;
+bool SettingsMenu::telemetryInterval( unsigned long interval ) {
+  telemetryMillis = interval;
+  return true;
 }
 
 
 /**
+ * settingsPollTelemetry
  * 
+ * Updates the values of the read-only settings, and redraws the values
+ * which are on the display and have changed.
  */
-bool highlightValue() {
+bool SettingsMenu::pollTelemetry() {
   bool result = true;
-  int row = currentSetting - topSetting;
-
-  // Determine the color to display the value
-  // WHITE when not editing
-  // BLUE when editing, but (value to display)  == (current value of setting)
-  // RED when editing, but (value to display)  != (current value of setting)
-  Setting *setting = &settings[currentSetting];
-  int color;
-  if( editing ) {
-    bool valueIsCurrent = setting->currentValue == setting->newValue;
-    if( valueIsCurrent )
-      color = BLUE;
-    else
-      color = RED;
-  } else
-    color = WHITE;
-    
-  result = result &&  displayValue( currentSetting, row, true, color, BLACK );
+  if( millis() - lastTelemetry < telemetryMillis )
+    return result;
+  lastTelemetry = millis();
+  char text[TELEMETRY_TEXT];
+  for( int i=0; i<nSettings; i++ ) {
+    Setting *setting = &settings[i];
+    if( setting->getFPtr == NULL )
+      continue;
+    if( !((TelemetryFDef) setting->getFPtr)(setting, text, TELEMETRY_TEXT) )
+      continue;
+    text[TELEMETRY_TEXT - 1] = '\0';
+    if( strcmp( text, setting->values[0] ) == 0 )
+      continue;
+    strcpy( setting->values[0], text );
+    result = result && redisplayValue( i );
+  }
   return result;
 }
 
 
 /**
+ * setCanApply
  * 
+ * Sets the function which checks if a value is acceptable for a setting.
+ * 
+ * Parameters:
+ * setting:   The setting
+ * canFPtr:   The check function, or NULL to allow all values.
  */
-bool displaySetting( int i, int row, bool clean, int colorFG, int colorBG ) {
-  bool result = true;
-  if( settings == NULL )
+bool setCanApply( Setting *setting, CanApplySettingFDef canFPtr ) {
+  if( setting == NULL )
     return false;
-  if( settings[i].name != NULL ) {
-    result = result && displayName( i, row, clean, colorFG, colorBG );
-    result = result && displayValue( i, row, clean, colorFG, colorBG );
-  } 
-  else
-    printAt( 0, row, "                          ", true, WHITE, BLACK, 0 );
-  return result;
+  setting->canFPtr = (void *) canFPtr;
+  return true;
 }
 
 
 /**
- * 
+ * Can the value with index 'newIndex' be applied to 'setting'?
+ * The current value of the setting is always acceptable.
  */
-bool displaySettings( int first ) {
-  bool result = true;
+static bool canApply( Setting *setting, int newIndex ) {
+  if( setting->canFPtr == NULL || newIndex == setting->currentValue )
+    return true;
+  return ((CanApplySettingFDef) setting->canFPtr)(setting, newIndex);
+}
 
-  if( !canUseDisplay )
-    return false;
-    
-  // clear the screen
-  myTFT->fillScreen( ST7735_BLACK );
 
-  // how many lines to display?
-  int n = nSettings - first;
-  if( n > TFT_LINES)
-    n = TFT_LINES;
+/**
+ * setRefresh
+ * 
+ * Sets the function which will be called when the value of a setting
+ * on which 'setting' depends has been changed.
+ * 
+ * Parameters:
+ * setting:     The setting
+ * refreshFPtr: The refresh function, or NULL.
+ */
+bool setRefresh( Setting *setting, RefreshSettingFDef refreshFPtr ) {
+  if( setting == NULL )
+    return false;
+  setting->refreshFPtr = (void *) refreshFPtr;
+  return true;
+}
 
-  // Display each setting from first to first+n-1
-  for( int i=0; i<n && result; i++ )
-    result = result && displaySetting( first+i, i, false, WHITE, BLACK );
 
-  topSetting = first;
-  
-  return result;
+/**
+ * Can setting 'to' be reached from setting 'from' by following 
+ * the dependencies?
+ */
+bool SettingsMenu::dependsOnPath( int from, int to ) {
+  if( from == to )
+    return true;
+  for( int i=0; i<nDependencies; i++ )
+    if( dependencies[i].dependsOn == from && dependsOnPath( dependencies[i].setting, to ) )
+      return true;
+  return false;
 }
 
 
 /**
+ * addDependency
  * 
+ * Declares that 'setting' depends on 'dependsOn'.
+ * 
+ * Parameters:
+ * setting:     The dependent setting
+ * dependsOn:   The setting it depends on
  */
-bool selectSetting( bool on ) {
-  bool result = true;
-  int row = currentSetting - topSetting;
-  char *sel = ">";
-  char *space = " ";
-  result = result && printAt( 0, row, on ? sel : space, true, WHITE, BLACK, 0 ); 
-  return result;
+bool SettingsMenu::addDependency( Setting *setting, Setting *dependsOn ) {
+  int i = index( setting );
+  int j = index( dependsOn );
+  if( i < 0 || j < 0 || nDependencies == MAX_DEPENDENCIES )
+    return false;
+  // 'dependsOn' may not already depend on 'setting'
+  if( dependsOnPath( i, j ) )
+    return false;
+  dependencies[nDependencies].setting = i;
+  dependencies[nDependencies].dependsOn = j;
+  nDependencies++;
+  return true;
 }
 
 
 /**
- * Call to indicate that the settings library can take over the display.
+ * Visit all settings which depend on setting 'i', and add them
+ * to 'order' after the settings which depend on them.
  */
-bool settingsDisplayOn() {
-  bool result = true;
-  canUseDisplay = true;
-  result = result && displaySettings( topSetting );
-  selectSetting( true );
-  return result;
+void SettingsMenu::visitDependents( int i ) {
+  for( int d=0; d<nDependencies; d++ ) {
+    int dependent = dependencies[d].setting;
+    if( dependencies[d].dependsOn == i && !(marks[dependent] & MARK_VISITED) ) {
+      marks[dependent] |= MARK_VISITED;
+      visitDependents( dependent );
+      order[nOrder++] = dependent;
+    }
+  }
 }
 
 
 /**
- * Call to indicate that the settings library cannot use the display anymore.
+ * Visit all settings on which setting 'i' depends, and add them
+ * to 'order' before setting 'i'.
  */
-bool settingsDisplayOff() {
-  bool result = true;
-  canUseDisplay = false;
-  editing = false;  // to prevent confusion
-  return result;
+void SettingsMenu::visitDependencies( int i ) {
+  marks[i] |= MARK_VISITED;
+  for( int d=0; d<nDependencies; d++ ) {
+    int dependsOn = dependencies[d].dependsOn;
+    if( dependencies[d].setting == i && !(marks[dependsOn] & MARK_VISITED) )
+      visitDependencies( dependsOn );
+  }
+  order[nOrder++] = i;
 }
 
 
 /**
- * 
+ * Mark setting 'i' as changed. The settings which depend on it
+ * will be refreshed in the next call to refreshDependents().
  */
-bool scrollValue( int d ) {
-  bool result = true;
-  Setting *setting = &settings[currentSetting];
-  if( setting == NULL )
-    return false;
-  
-  // determine the new value to select
-  int currentNewValue = setting->newValue;
-  int newNewValue = setting->newValue;
-  if( d > 0 && currentNewValue < setting->nValues-1 )
-    newNewValue += d;
-  else
-    if( d < 0 && currentNewValue > 0 )
-      newNewValue += d;
-
-  // if it is different than the current value, select it
-  if( newNewValue != currentNewValue ) {
-    setting->newValue = newNewValue;
-    result = result && highlightValue();
-    if( setting->liveUpdate )
-      // save result to be able to reset in settingsOK() if
-      // this value is not accepted for some reason.
-      setting->can = (((ChangeSettingFDef) setting->fPtr)(setting));
-  }
-
-  return result;
+void SettingsMenu::markChanged( int i ) {
+  if( marks != NULL )
+    marks[i] |= MARK_CHANGED;
 }
 
 
 /**
- * 
+ * Call the refresh function of all settings which depend on
+ * the changed settings, each one once, in dependency order.
  */
-bool scrollSetting( int d ) {
+bool SettingsMenu::refreshDependents() {
   bool result = true;
-  // determine the new setting to select
-  int newSetting = currentSetting;
-  do {
-    if( d > 0 && newSetting < nSettings-1 )
-      newSetting += d;
-    else if( d < 0 && newSetting > 0 )
-      newSetting += d;
-    else
-      return false;
-  } while (settings[newSetting].name == NULL );
+  if( marks == NULL )
+    return result;
 
-  // if it is different than the current setting, select it
-  if( newSetting != currentSetting ) {
-    // unselect the previous current setting ...
-    selectSetting( false );
-    // ... to select the new current setting
-    currentSetting = newSetting;
-    // Is the current setting still visible on the screen?
-    if( currentSetting < topSetting ) {
-      result = result && displaySettings( currentSetting ); 
-    }
-    else if( currentSetting >= topSetting + TFT_LINES ) {
-      result = result && displaySettings( currentSetting - TFT_LINES + 1 ); 
-    }
-    selectSetting( true );
+  // Walk the dependents of the changed settings only
+  nOrder = 0;
+  for( int i=0; i<nSettings && nDependencies>0; i++ )
+    if( marks[i] & MARK_CHANGED )
+      visitDependents( i );
+
+  // 'order' has the dependents after the settings depending on them
+  for( int i=nOrder-1; i>=0; i-- ) {
+    Setting *setting = &settings[order[i]];
+    if( setting->refreshFPtr != NULL )
+      result = ((RefreshSettingFDef) setting->refreshFPtr)(setting) && result;
   }
+  memset( marks, 0, nSettings );
   return result;
 }
 
 
 /**
- * To indicate that 'up' has been given.
- * 
- * The state machine in this library decides what action to take, change the selected setting,
- * or change the value of the selected setting.
+ * The value of setting 'i' has been changed, refresh the
+ * settings depending on it.
  */
-bool settingsUp() {
-  bool result = true;
-  if( editing ) {
-      result = result && scrollValue( 1 );
-  } else {
-      result = result && scrollSetting( 1 );
-  }
-  return result;
+bool SettingsMenu::settingChanged( int i ) {
+  markChanged( i );
+  return refreshDependents();
 }
 
 
 /**
- * To indicate that 'down' has been given.
- * 
- * The state machine in this library decides what action to take, change the selected setting,
- * or change the value of the selected setting.
+ * Call the ChangeSettingFDef of 'setting'.
  */
-bool settingsDown() {
-  bool result = true;
-  if( editing ) {
-      result = result && scrollValue( -1 );
-  } else {
-      result = result && scrollSetting( -1 );
+bool SettingsMenu::callChange( Setting *setting ) {
+#if defined( SETTINGS_TIMING ) || defined( SETTINGS_STATS )
+  unsigned long start = micros();
+  bool result = ((ChangeSettingFDef) setting->fPtr)(setting);
+  unsigned long elapsed = micros() - start;
+  STATS_ADD( callbacks, 1 );
+  STATS_ADD( callbackMicros, elapsed );
+#ifdef SETTINGS_TIMING
+  if( timings != NULL ) {
+    SettingTiming *timing = &timings[setting - settings];
+    if( timing->count == 0 || elapsed < timing->minMicros )
+      timing->minMicros = elapsed;
+    if( elapsed > timing->maxMicros )
+      timing->maxMicros = elapsed;
+    timing->totalMicros += elapsed;
+    timing->count++;
+    int bucket = 0;
+    while( (elapsed >>= 1) != 0 && bucket < TIMING_BUCKETS-1 )
+      bucket++;
+    timing->buckets[bucket]++;
   }
+#endif
   return result;
+#else
+  return ((ChangeSettingFDef) setting->fPtr)(setting);
+#endif
 }
 
 
+#ifdef SETTINGS_TIMING
 /**
- * Call to indicate that 'OK' has been given.
+ * settingsTiming
  * 
- * The state machine in this library decides what action to take, go into edit mode
- * or save the current value into the selected setting.
+ * Gets the timing of the calls to the ChangeSettingFDef of a setting.
+ * 
+ * Parameters:
+ * setting:   The setting
+ * timing:    Receives the timing
  */
-bool settingsOK() {
-  bool result = true;
-  Setting *setting = &settings[currentSetting];
-  if( editing ) {
-    // change value of setting
-    if( setting->newValue != setting->currentValue )
-      if( setting->liveUpdate ) {
-        // The setting has already been updated to its new value
-        if( setting->can )
-          setting->currentValue = setting->newValue;
-        else       
-          setting->newValue = setting->currentValue;
-      }
-      else if(((ChangeSettingFDef) setting->fPtr)(setting))
-        setting->currentValue = setting->newValue;
-      else
-        setting->newValue = setting->currentValue;
-  } else {
-    // start editing the value of the current setting
-    // ...?
-  }
-  if( result )
-    editing = !editing;
-  highlightValue();    
-  return result;
+bool SettingsMenu::timing( Setting *setting, SettingTiming *timing ) {
+  int i = index( setting );
+  if( timings == NULL || i < 0 || timing == NULL )
+    return false;
+  *timing = timings[i];
+  return true;
 }
 
 
 /**
-  // Must the value be reset to its current value? This is 
-  // the case when this setting will be updated live AND
-  // the new value != current value AND the new value
-  // has been accepted by the client.
+ * settingsTimingReset
+ * 
+ * Clears the timing of all settings.
  */
-bool resetNewValue() {
-  bool result = true;
-  Setting *setting = &settings[currentSetting];
-
-  // Must the value be reset to its current value? This is 
-  // the case when this setting will be updated live AND
-  // the new value != current value AND the new value
-  // has been accepted by the client.
-  bool resetLive = setting->liveUpdate && 
-                   setting->can &&
-                   (setting->newValue != setting->currentValue);
-  setting->newValue = setting->currentValue;
-  if( resetLive )
-    // Not interested in the result of this call.
-    (((ChangeSettingFDef) setting->fPtr)(setting));
-
-  return result;
+bool SettingsMenu::timingReset() {
+  if( timings == NULL )
+    return false;
+  memset( timings, 0, sizeof( SettingTiming ) * maxSettings );
+  return true;
 }
 
 
 /**
- * Call to indicate that 'Cancel' has been given.
+ * settingsTimingDump
  * 
+ * Prints the timing of all settings, one line per setting:
+ * name, count, min, max, total, buckets.
  * 
+ * Parameters:
+ * out:       Where to print to, e.g. &Serial
  */
-bool settingsStop() {
-  bool result = true;
-  if( editing ) {
-    result = result && resetNewValue();
+bool SettingsMenu::timingDump( Print *out ) {
+  if( timings == NULL || out == NULL )
+    return false;
+  for( int i=0; i<nSettings; i++ ) {
+    SettingTiming *timing = &timings[i];
+    if( settings[i].name == NULL )
+      continue;
+    out->print( settings[i].name );
+    out->print( '\t' );
+    out->print( timing->count );
+    out->print( '\t' );
+    out->print( timing->minMicros );
+    out->print( '\t' );
+    out->print( timing->maxMicros );
+    out->print( '\t' );
+    out->print( timing->totalMicros );
+    for( int b=0; b<TIMING_BUCKETS; b++ ) {
+      out->print( b == 0 ? '\t' : ' ' );
+      out->print( timing->buckets[b] );
+    }
+    out->println();
+  }
+  return true;
+}
+#endif
+
+
+#ifdef SETTINGS_STATS
+/**
+ * settingsStats
+ * 
+ * Return:
+ * The counters of the work done by the library.
+ */
+SettingsStats SettingsMenu::stats() {
+  return statistics;
+}
+
+
+/**
+ * settingsStatsReset
+ * 
+ * Clears the counters.
+ */
+bool SettingsMenu::statsReset() {
+  memset( &statistics, 0, sizeof( statistics ) );
+  return true;
+}
+#endif
+
+
+#ifdef SETTINGS_LATENCY
+/**
+ * An input event starts.
+ */
+void SettingsMenu::latencyStart() {
+  if( !stamped )
+    eventStart = micros();
+  stamped = false;
+  drawn = false;
+}
+
+
+/**
+ * An input event has been handled. If the display has been updated,
+ * record the latency until the last drawing for the event was done. Work
+ * done after that, e.g. in the ChangeSettingFDef of a setting with 
+ * liveUpdate, is not seen by the user and is not part of the latency.
+ */
+void SettingsMenu::latencyEnd( int event ) {
+  if( !drawn )
+    return;
+  unsigned long elapsed = drawnMicros - eventStart;
+  LatencyLog *log = &latencies[event];
+  log->samples[log->next] = elapsed;
+  log->next = (log->next + 1) % LATENCY_SAMPLES;
+  log->count++;
+  if( elapsed > log->maxMicros )
+    log->maxMicros = elapsed;
+}
+
+
+/**
+ * settingsInputStamp
+ * 
+ * Sets the time of the next input event.
+ * 
+ * Parameters:
+ * stamp:     micros() at the time of the input event
+ */
+bool SettingsMenu::inputStamp( unsigned long stamp ) {
+  eventStart = stamp;
+  stamped = true;
+  return true;
+}
+
+
+/**
+ * settingsLatency
+ * 
+ * Gets the latency of an input event.
+ * 
+ * Parameters:
+ * event:     LATENCY_UP, LATENCY_DOWN, LATENCY_OK or LATENCY_STOP
+ * latency:   Receives the latency
+ */
+bool SettingsMenu::latency( int event, SettingsLatency *latency ) {
+  if( event < 0 || event >= LATENCY_EVENTS || latency == NULL )
+    return false;
+  LatencyLog *log = &latencies[event];
+  latency->count = log->count;
+  latency->maxMicros = log->maxMicros;
+  latency->p50Micros = 0;
+  latency->p99Micros = 0;
+  int n = log->count < LATENCY_SAMPLES ? log->count : LATENCY_SAMPLES;
+  if( n == 0 )
+    return true;
+
+  // sort a copy of the samples
+  unsigned long sorted[LATENCY_SAMPLES];
+  for( int i=0; i<n; i++ ) {
+    unsigned long sample = log->samples[i];
+    int j = i;
+    for( ; j>0 && sorted[j-1] > sample; j-- )
+      sorted[j] = sorted[j-1];
+    sorted[j] = sample;
+  }
+  latency->p50Micros = sorted[(n - 1) * 50 / 100];
+  latency->p99Micros = sorted[(n - 1) * 99 / 100];
+  return true;
+}
+
+
+/**
+ * settingsLatencyReset
+ * 
+ * Clears the latencies of all events.
+ */
+bool SettingsMenu::latencyReset() {
+  memset( latencies, 0, sizeof( latencies ) );
+  return true;
+}
+#endif
+
+
+#ifdef SETTINGS_TRACE
+/**
+ * Add a record to the trace, overwriting the oldest one if it is full.
+ * 'length' characters of 'text' are copied, at most TRACE_TEXT.
+ */
+void SettingsMenu::traceRecord( char op, int x, int y, int w, int h, int color, const char *text, int length ) {
+  if( trace == NULL )
+    return;
+  // in each half of the trace, the state is kept at the first call
+  if( traceCount % (TRACE_RECORDS / 2) == 0 )
+    traceDue = true;
+  if( traceDue && op >= 'A' && op <= 'Z' )
+    traceSnapshot();
+  TraceRecord *record = &trace[traceCount % TRACE_RECORDS];
+  record->micros = micros();
+  record->op = op;
+  record->x = x;
+  record->y = y;
+  record->w = w;
+  record->h = h;
+  record->color = color;
+  record->length = -1;
+  if( text != NULL ) {
+    record->length = length < TRACE_TEXT ? length : TRACE_TEXT;
+    memcpy( record->text, text, record->length );
+  }
+  traceCount++;
+}
+
+
+/**
+ * Keep the state of the menu before the record which is added next,
+ * in place of the oldest kept state.
+ */
+void SettingsMenu::traceSnapshot() {
+  traceLast = traceLast == 0 ? 1 : 0;
+  TraceState *state = &traceStates[traceLast];
+  state->valid = true;
+  state->count = traceCount;
+  state->micros = micros();
+  state->displayed = canUseDisplay;
+  getUiState( &state->ui );
+  state->nValues = nSettings;
+  for( int i=0; i<nSettings; i++ )
+    state->values[i] = settings[i].currentValue;
+  traceDue = false;
+}
+
+
+/**
+ * settingsTraceDump
+ * 
+ * Prints the recorded trace, one line per record. It starts with the oldest
+ * kept state of which all later records are still in the trace.
+ * 
+ * Parameters:
+ * out:       Where to print to, e.g. &Serial
+ */
+bool SettingsMenu::traceDump( Print *out ) {
+  if( out == NULL || trace == NULL )
+    return false;
+  unsigned long first = traceCount > TRACE_RECORDS ? traceCount - TRACE_RECORDS : 0;
+  TraceState *state = NULL;
+  for( int s=0; s<2; s++ )
+    if( traceStates[s].valid && traceStates[s].count >= first &&
+        (state == NULL || traceStates[s].count < state->count) )
+      state = &traceStates[s];
+  if( state != NULL ) {
+    first = state->count;
+    out->print( state->micros );
+    out->print( ' ' );
+    out->print( TRACE_STATE );
+    out->print( ' ' );
+    out->print( state->ui.currentSetting );
+    out->print( ' ' );
+    out->print( state->ui.topSetting );
+    out->print( ' ' );
+    out->print( state->ui.editing ? 1 : 0 );
+    out->print( ' ' );
+    out->print( state->displayed ? 1 : 0 );
+    out->print( ' ' );
+    out->print( state->ui.newValue );
+    for( int i=0; i<state->nValues; i++ ) {
+      out->print( ' ' );
+      out->print( state->values[i] );
+    }
+    out->println();
+  }
+  for( unsigned long r=first; r<traceCount; r++ ) {
+    TraceRecord *record = &trace[r % TRACE_RECORDS];
+    out->print( record->micros );
+    out->print( ' ' );
+    out->print( record->op );
+    out->print( ' ' );
+    out->print( record->x );
+    out->print( ' ' );
+    out->print( record->y );
+    out->print( ' ' );
+    out->print( record->w );
+    out->print( ' ' );
+    out->print( record->h );
+    out->print( ' ' );
+    out->print( record->color );
+    if( record->length >= 0 ) {
+      out->print( ' ' );
+      out->write( (const unsigned char *) record->text, record->length );
+    }
+    out->println();
+  }
+  return true;
+}
+
+
+/**
+ * settingsTraceClear
+ * 
+ * Clears the recorded trace. The state of the menu is kept again at the
+ * next call.
+ */
+bool SettingsMenu::traceClear() {
+  traceCount = 0;
+  traceLast = -1;
+  traceDue = true;
+  for( int s=0; s<2; s++ )
+    traceStates[s].valid = false;
+  return true;
+}
+
+
+/**
+ * Call the library function for the 'op' of a trace record.
+ */
+bool SettingsMenu::replayOp( char op ) {
+  switch( op ) {
+    case TRACE_UP: return up();
+    case TRACE_DOWN: return down();
+    case TRACE_OK: return ok();
+    case TRACE_STOP: return stop();
+    case TRACE_DISPLAY_ON: return displayOn();
+    case TRACE_DISPLAY_OFF: return displayOff();
+    case TRACE_DISPLAY_RESUME: return displayOn();
+    default: return true; // drawing, will be done by the library itself
+  }
+}
+
+
+/**
+ * Number 'n' of a state record has been read: the selected setting, the
+ * first setting on the display, editing, displayed, the value being edited
+ * and the current value of each setting.
+ */
+void SettingsMenu::replayField( int n, long value, long *fields ) {
+  if( n < 5 ) {
+    fields[n] = value;
+    return;
+  }
+  Setting *setting = this->setting( n - 5 );
+  if( setting == NULL || setting->name == NULL || setting->getFPtr != NULL || value >= setting->nValues )
+    return;
+  setting->currentValue = value;
+  setting->newValue = value;
+}
+
+
+/**
+ * Set the state of the menu as in a state record, after its current 
+ * values have been set by replayField().
+ */
+bool SettingsMenu::replayState( const long *fields, int nFields ) {
+  bool result = true;
+  if( nFields < 5 || batch || quick )
+    return false;
+  canUseDisplay = false;
+  editing = false;
+  SettingsUiState state;
+  state.currentSetting = fields[0];
+  state.topSetting = fields[1];
+  state.editing = fields[2] != 0;
+  state.newValue = fields[4];
+  result = result && setUiState( &state );
+  if( fields[3] != 0 )
+    result = result && displayOn();
+  return result;
+}
+
+
+/**
+ * settingsTraceReplay
+ * 
+ * Reads a trace printed by settingsTraceDump() and calls the library functions
+ * which have been recorded in it. A state record sets the state of the menu.
+ * 
+ * Parameters:
+ * in:        The trace, read until the end of the stream
+ */
+bool SettingsMenu::traceReplay( Stream *in ) {
+  bool result = true;
+  if( in == NULL )
+    return false;
+  // Only the op is needed from each line, it follows the time. Of a
+  // state record, the numbers after the op are needed as well.
+  long fields[5];
+  long number = 0;
+  bool digits = false;  // a number is being read
+  int nFields = 0;      // numbers read after the op
+  int field = 0;        // the time is field 0, the op field 1
+  char op = 0;
+  int c;
+  do {
+    c = in->read();
+    if( c == '\r' )
+      continue;
+    if( op == TRACE_STATE && c >= '0' && c <= '9' ) {
+      number = (digits ? number * 10 : 0) + c - '0';
+      digits = true;
+      continue;
+    }
+    if( digits )
+      replayField( nFields++, number, fields );
+    digits = false;
+    if( c == '\n' || c < 0 ) {
+      if( op == TRACE_STATE )
+        result = replayState( fields, nFields ) && result;
+      else if( op != 0 )
+        result = replayOp( op ) && result;
+      field = 0;
+      op = 0;
+      nFields = 0;
+    }
+    else if( c == ' ' )
+      field++;
+    else if( field == 1 )
+      op = c;
+  } while( c >= 0 );
+  return result;
+}
+#endif
+
+
+#ifdef SETTINGS_SCREEN
+/**
+ * Clear the characters from column 'x' and line 'y', 'w' characters wide 
+ * and 'h' lines high, in the screen model.
+ */
+void SettingsMenu::screenFill( int x, int y, int w, int h ) {
+  for( int row=y; row<y+h && row<TFT_LINES; row++ ) {
+    for( int col=x; col<x+w && col<TFT_CHARS; col++ ) {
+      screen[row][col] = ' ';
+      screen[row][TFT_CHARS + 1 + col] = ' ';
+    }
+    screen[row][TFT_CHARS] = '|';
+    screen[row][SCREEN_LINE_LENGTH] = '\0';
+  }
+}
+
+
+/**
+ * Draw 'length' characters of 'text' preceded by 'leading' spaces at column 'x'
+ * on line 'y' in the screen model. The background is not cleared, like on the display.
+ */
+void SettingsMenu::screenPrint( int x, int y, int leading, const char *text, int length, int color ) {
+  char code;
+  switch( color ) {
+    case BLACK: code = ' '; break;
+    case WHITE: code = 'W'; break;
+    case BLUE: code = 'B'; break;
+    case RED: code = 'R'; break;
+    case GREEN: code = 'G'; break;
+    case CYAN: code = 'C'; break;
+    case MAGENTA: code = 'M'; break;
+    case YELLOW: code = 'Y'; break;
+    default: code = '?';
+  }
+  int col = x + leading;
+  if( y < 0 || y >= TFT_LINES )
+    return;
+  for( ; length > 0 && col<TFT_CHARS; text++, col++, length-- ) {
+    if( *text == ' ' )
+      // nothing is drawn for a space
+      continue;
+    char *cell = &screen[y][col];
+    if( *cell == ' ' ) {
+      *cell = *text;
+      screen[y][TFT_CHARS + 1 + col] = code;
+    }
+    else if( *cell != *text || screen[y][TFT_CHARS + 1 + col] != code )
+      *cell = '#';
+  }
+}
+
+
+/**
+ * settingsScreenDump
+ * 
+ * Prints the screen model, one line per text line of the display.
+ * 
+ * Parameters:
+ * out:       Where to print to, e.g. &Serial
+ */
+bool SettingsMenu::screenDump( Print *out ) {
+  if( out == NULL )
+    return false;
+  for( int row=0; row<TFT_LINES; row++ )
+    out->println( screen[row] );
+  return true;
+}
+
+
+/**
+ * settingsScreenCompare
+ * 
+ * Compares the screen model with the expected screen, both the characters
+ * and their colors.
+ * 
+ * Parameters:
+ * expected:  TFT_LINES lines, in the format of settingsScreenDump()
+ * diff:      If not NULL, the lines which differ are printed here
+ * 
+ * Return:
+ * The number of characters and colors which differ
+ */
+int SettingsMenu::screenCompare( const char * const *expected, Print *diff ) {
+  int differences = 0;
+  for( int row=0; row<TFT_LINES; row++ ) {
+    const char *line = expected[row];
+    char marks[SCREEN_LINE_LENGTH + 1];
+    int n = 0;
+    bool ended = false;
+    for( int col=0; col<SCREEN_LINE_LENGTH; col++ ) {
+      // a short expected line is padded with spaces, "" is an empty line
+      ended = ended || line[col] == '\0';
+      char want = ended ? (col == TFT_CHARS ? '|' : ' ') : line[col];
+      bool differs = screen[row][col] != want;
+      marks[col] = differs ? '^' : ' ';
+      if( differs )
+        n++;
+    }
+    marks[SCREEN_LINE_LENGTH] = '\0';
+    if( n > 0 && diff != NULL ) {
+      diff->print( "line " );
+      diff->println( row );
+      diff->print( "  expected: " );
+      diff->println( line );
+      diff->print( "  actual:   " );
+      diff->println( screen[row] );
+      diff->print( "            " );
+      diff->println( marks );
+    }
+    differences += n;
+  }
+  return differences;
+}
+#endif
+
+
+/**
+ * Call to initialise the settings library.
+ * 
+ * Parameters:
+ * n:         max number of settings which can be used.
+ * tft:       The display which can be used. The display should already 
+ *            be initialised.
+ * nValues:   The number of values of all settings together, to size the
+ *            index of the values. 0 for INDEX_VALUES per setting.
+ */
+bool SettingsMenu::init( int n, ST7735_t3 *tft, int nValues ) {
+  bool result = true;
+  myTFT = tft;
+  maxSettings = n;
+  settings = (Setting *) malloc( sizeof( Setting ) * n );
+  result = result && (settings != NULL);
+  changeSet = (Setting **) malloc( sizeof( Setting * ) * n );
+  result = result && (changeSet != NULL);
+  marks = (unsigned char *) malloc( n );
+  result = result && (marks != NULL);
+  if( marks != NULL )
+    memset( marks, 0, n );
+  order = (int *) malloc( sizeof( int ) * n );
+  result = result && (order != NULL);
+  // the index of the names is at most half full
+  for( nNameIndex = 2; nNameIndex < 2 * n; nNameIndex <<= 1 )
+    ;
+  nameIndex = (HashKey *) malloc( sizeof( HashKey ) * nNameIndex );
+  result = result && (nameIndex != NULL);
+  for( int i=0; nameIndex != NULL && i<nNameIndex; i++ )
+    nameIndex[i].setting = -1;
+  // and so is the index of the values
+  if( nValues <= 0 )
+    nValues = INDEX_VALUES * n;
+  for( nValueIndex = 2; nValueIndex < 2 * nValues; nValueIndex <<= 1 )
+    ;
+  valueIndex = (HashKey *) malloc( sizeof( HashKey ) * nValueIndex );
+  result = result && (valueIndex != NULL);
+  if( valueIndex == NULL )
+    nValueIndex = 0;
+  for( int i=0; valueIndex != NULL && i<nValueIndex; i++ )
+    valueIndex[i].setting = -1;
+#ifdef SETTINGS_TIMING
+  timings = (SettingTiming *) malloc( sizeof( SettingTiming ) * n );
+  result = result && (timings != NULL);
+  timingReset();
+#endif
+#ifdef SETTINGS_TRACE
+  trace = (TraceRecord *) malloc( sizeof( TraceRecord ) * TRACE_RECORDS );
+  result = result && (trace != NULL);
+  for( int s=0; s<2; s++ ) {
+    traceStates[s].values = (int *) malloc( sizeof( int ) * n );
+    result = result && (traceStates[s].values != NULL);
+  }
+  traceClear();
+#endif
+  return result;
+}
+
+
+/**
+ * 
+ */
+bool SettingsMenu::printAt( int x, int y, const char *text, bool clean, int colorFG, int colorBG, int leading, int width ) {
+  bool result = true;
+  if( !canUseDisplay ) {
+    // the row is drawn by displayResume()
+    if( y >= 0 && y < winH )
+      staleRows |= 1UL << y;
+    return result;
+  }
+  // clip to 'width' and to the window
+  int nText = text != NULL ? strlen( text ) : 0;
+  if( y < 0 || y >= winH || x >= winW )
+    return result;
+  if( width > winW - x )
+    width = winW - x;
+  if( leading > width )
+    leading = width;
+  if( leading + nText > width )
+    nText = width - leading;
+  int n = leading + nText;
+  STATS_START( start );
+  int col = (winX + x) * CHAR_WIDTH;
+  int row = (winY + y) * CHAR_HEIGHT;
+  if ( clean ) {
+    myTFT->fillRect( col, row, n * CHAR_WIDTH, CHAR_HEIGHT, colorBG );
+    TRACE( TRACE_FILL_RECT, col, row, n * CHAR_WIDTH, CHAR_HEIGHT, colorBG, NULL );
+    SCREEN_FILL( winX + x, winY + y, n, 1 );
+    STATS_ADD( pixels, n * CHAR_WIDTH * CHAR_HEIGHT );
+  }
+  if( text != NULL ) {
+    myTFT->setCursor( col, row );
+    myTFT->setTextColor( colorFG );
+    for( int i=0; i<leading; i++ )
+      myTFT->print( " " );
+    for( int i=0; i<nText; i++ )
+      myTFT->print( text[i] );
+    TRACE_STRING( TRACE_PRINT, col, row, leading, CHAR_HEIGHT, colorFG, text, nText );
+    SCREEN_PRINT( winX + x, winY + y, leading, text, nText, colorFG );
+    STATS_ADD( glyphs, n );
+  }
+  // the latency of an event ends when its last drawing has been done
+  LATENCY_DRAWN();
+  STATS_TIME( printMicros, start );
+  return result;
+}
+
+
+
+/*
+012345....0....5....0....5.
+> SAMPLERATE       96000
+  IF               5000
+  INTERMED FREQ
+  OUT FILTER MAX
+  OUT FILTER TAPS
+ */
+
+
+/**
+ * 
+ */
+bool SettingsMenu::displayName( int i, int row, bool clean, int colorFG, int colorBG ) {
+  bool result = true;
+  if( settings == NULL )
+    return false;
+  // the name is cut off before the value
+  result = result && printAt( NAME_COLUMN, row, settings[i].name, clean, colorFG, colorBG, 0, winW - VALUE_CHARS - NAME_COLUMN );
+  return result;
+}
+
+
+/**
+ * 
+ */
+bool SettingsMenu::displayValue( int i, int row, bool clean, int colorFG, int colorBG ) {
+  bool result = true;
+  if( settings == NULL )
+    return false;
+  int actual = settings[i].newValue;
+  const char *text = valueText( i, actual );
+  int leading = VALUE_CHARS - strlen( text );
+  result = result && printAt( winW - VALUE_CHARS, row, text, clean, colorFG, colorBG, leading > 0 ? leading : 0 );
+  return result;
+}
+
+
+/**
+ * 
+ */
+bool SettingsMenu::highlightValue() {
+  bool result = true;
+  int row = currentSetting - topSetting;
+  STATS_START( start );
+
+  // Determine the color to display the value
+  // WHITE when not editing
+  // BLUE when editing, but (value to display)  == (current value of setting)
+  // RED when editing, but (value to display)  != (current value of setting)
+  Setting *setting = &settings[currentSetting];
+  int color;
+  if( editing ) {
+    bool valueIsCurrent = setting->currentValue == setting->newValue;
+    if( valueIsCurrent )
+      color = BLUE;
+    else
+      color = RED;
+  } else if( setting->pending )
+    color = RED;
+  else
+    color = WHITE;
+    
+  result = result &&  displayValue( currentSetting, row, true, color, BLACK );
+  STATS_ADD( repaints, 1 );
+  STATS_TIME( repaintMicros, start );
+  return result;
+}
+
+
+/**
+ * 
+ */
+bool SettingsMenu::displaySetting( int i, int row, bool clean, int colorFG, int colorBG ) {
+  bool result = true;
+  if( settings == NULL )
+    return false;
+  if( settings[i].name != NULL ) {
+    result = result && displayName( i, row, clean, colorFG, colorBG );
+    result = result && displayValue( i, row, clean, settings[i].pending ? RED : colorFG, colorBG );
+  } 
+  else
+    printAt( 0, row, "                          ", true, WHITE, BLACK, 0 );
+  return result;
+}
+
+
+/**
+ * 
+ */
+bool SettingsMenu::displaySettings( int first ) {
+  bool result = true;
+
+  if( !canUseDisplay ) {
+    stale = true;
+    return false;
+  }
+  STATS_START( start );
+    
+  // clear the window, or the whole screen
+  if( winW == TFT_CHARS && winH == TFT_LINES ) {
+    myTFT->fillScreen( ST7735_BLACK );
+    TRACE( TRACE_FILL_SCREEN, 0, 0, TFT_WIDTH, TFT_HEIGHT, BLACK, NULL );
+    STATS_ADD( pixels, TFT_WIDTH * TFT_HEIGHT );
+  }
+  else {
+    myTFT->fillRect( winX * CHAR_WIDTH, winY * CHAR_HEIGHT, winW * CHAR_WIDTH, winH * CHAR_HEIGHT, BLACK );
+    TRACE( TRACE_FILL_RECT, winX * CHAR_WIDTH, winY * CHAR_HEIGHT, winW * CHAR_WIDTH, winH * CHAR_HEIGHT, BLACK, NULL );
+    STATS_ADD( pixels, winW * CHAR_WIDTH * winH * CHAR_HEIGHT );
+  }
+  LATENCY_DRAWN();
+  SCREEN_FILL( winX, winY, winW, winH );
+
+  // how many lines to display?
+  int n = nSettings - first;
+  if( n > winH )
+    n = winH;
+
+  // Display each setting from first to first+n-1
+  for( int i=0; i<n && result; i++ )
+    result = result && displaySetting( first+i, i, false, WHITE, BLACK );
+
+  topSetting = first;
+  STATS_ADD( redraws, 1 );
+  STATS_TIME( redrawMicros, start );
+  
+  return result;
+}
+
+
+/**
+ * 
+ */
+bool SettingsMenu::selectSetting( bool on ) {
+  bool result = true;
+  int row = currentSetting - topSetting;
+  char *sel = ">";
+  char *space = " ";
+  result = result && printAt( 0, row, on ? sel : space, true, WHITE, BLACK, 0 ); 
+  return result;
+}
+
+
+/**
+ * Call to indicate that the settings library can take over the display.
+ */
+bool SettingsMenu::displayOn() {
+  bool result = true;
+  TRACE_CALL( TRACE_DISPLAY_ON );
+  canUseDisplay = true;
+  result = result && displaySettings( topSetting );
+  selectSetting( true );
+  if( editing )
+    highlightValue();
+  stale = !result;
+  staleRows = 0;
+  return result;
+}
+
+
+/**
+ * Call to indicate that the settings library cannot use the display anymore.
+ * The selected setting, and the value being edited, are kept.
+ */
+bool SettingsMenu::displayOff() {
+  bool result = true;
+  TRACE_CALL( TRACE_DISPLAY_OFF );
+  canUseDisplay = false;
+  return result;
+}
+
+
+/**
+ * settingsDisplayResume
+ * 
+ * Like displayOn(), but only redraws the lines of the menu in the part
+ * of the display (in pixels) which has been used by the application.
+ */
+bool SettingsMenu::displayResume( int x, int y, int w, int h ) {
+  bool result = true;
+  if( stale )
+    return displayOn();
+  TRACE( TRACE_DISPLAY_RESUME, x, y, w, h, 0, NULL );
+  canUseDisplay = true;
+
+  // keep to the window
+  int left = winX * CHAR_WIDTH;
+  int top = winY * CHAR_HEIGHT;
+  if( x < left ) {
+    w -= left - x;
+    x = left;
+  }
+  if( y < top ) {
+    h -= top - y;
+    y = top;
+  }
+  if( x + w > left + winW * CHAR_WIDTH )
+    w = left + winW * CHAR_WIDTH - x;
+  if( y + h > top + winH * CHAR_HEIGHT )
+    h = top + winH * CHAR_HEIGHT - y;
+  if( (w <= 0 || h <= 0) && staleRows == 0 )
+    return result;
+
+  STATS_START( start );
+  int first = 0;
+  int last = -1;
+  if( w > 0 && h > 0 ) {
+    myTFT->fillRect( x, y, w, h, BLACK );
+    LATENCY_DRAWN();
+    TRACE( TRACE_FILL_RECT, x, y, w, h, BLACK, NULL );
+    // a character which is only partly cleared is not cleared in the model
+    SCREEN_FILL( (x + CHAR_WIDTH - 1) / CHAR_WIDTH, (y + CHAR_HEIGHT - 1) / CHAR_HEIGHT,
+                 (x + w) / CHAR_WIDTH - (x + CHAR_WIDTH - 1) / CHAR_WIDTH,
+                 (y + h) / CHAR_HEIGHT - (y + CHAR_HEIGHT - 1) / CHAR_HEIGHT );
+    STATS_ADD( pixels, w * h );
+    first = (y - top) / CHAR_HEIGHT;
+    last = (y - top + h - 1) / CHAR_HEIGHT;
+  }
+
+  // redraw the lines in that part, and the lines which have not been drawn
+  for( int row = 0; row < winH; row++ ) {
+    int i = topSetting + row;
+    bool covered = row >= first && row <= last;
+    bool notDrawn = (staleRows & (1UL << row)) != 0;
+    if( i >= nSettings )
+      break;
+    if( !covered && !notDrawn )
+      continue;
+    // a row which has not been drawn may only be partly covered
+    if( notDrawn ) {
+      myTFT->fillRect( left, top + row * CHAR_HEIGHT, winW * CHAR_WIDTH, CHAR_HEIGHT, BLACK );
+      LATENCY_DRAWN();
+      TRACE( TRACE_FILL_RECT, left, top + row * CHAR_HEIGHT, winW * CHAR_WIDTH, CHAR_HEIGHT, BLACK, NULL );
+      SCREEN_FILL( winX, winY + row, winW, 1 );
+      STATS_ADD( pixels, winW * CHAR_WIDTH * CHAR_HEIGHT );
+    }
+    result = result && displaySetting( i, row, false, WHITE, BLACK );
+    if( i == currentSetting ) {
+      selectSetting( true );
+      if( editing )
+        highlightValue();
+    }
+  }
+  staleRows = 0;
+  STATS_ADD( redraws, 1 );
+  STATS_TIME( redrawMicros, start );
+  return result;
+}
+
+
+/**
+ * settingsQuickEdit
+ * 
+ * Starts editing the value of 'setting' on a single line of the display,
+ * while the menu is not displayed.
+ * 
+ * Parameters:
+ * setting:     The setting to edit
+ * line:        The line of the display to use
+ * repaintFPtr: If not NULL, called with the part of the display to repaint
+ *              when the editing has ended
+ */
+bool SettingsMenu::quickEdit( Setting *setting, int line, RepaintFDef repaintFPtr ) {
+  bool result = true;
+  if( setting == NULL || settings == NULL || setting->name == NULL || setting->getFPtr != NULL ||
+      canUseDisplay || batch || quick || line < 0 || line >= TFT_LINES )
+    return false;
+  int i = setting - settings;
+  if( i < 0 || i >= nSettings || (editing && i == currentSetting) )
+    return false;
+
+  // the menu is kept, the line is a window with only this setting
+  quickSaved.currentSetting = currentSetting;
+  quickSaved.topSetting = topSetting;
+  quickSaved.editing = editing;
+  quickWindow[0] = winX;
+  quickWindow[1] = winY;
+  quickWindow[2] = winW;
+  quickWindow[3] = winH;
+  winX = 0;
+  winY = line;
+  winW = TFT_CHARS;
+  winH = 1;
+  currentSetting = i;
+  topSetting = i;
+  editing = true;
+  quick = true;
+  this->repaintFPtr = repaintFPtr;
+  canUseDisplay = true;
+
+  myTFT->fillRect( 0, line * CHAR_HEIGHT, TFT_WIDTH, CHAR_HEIGHT, BLACK );
+  TRACE( TRACE_FILL_RECT, 0, line * CHAR_HEIGHT, TFT_WIDTH, CHAR_HEIGHT, BLACK, NULL );
+  SCREEN_FILL( 0, line, TFT_CHARS, 1 );
+  STATS_ADD( pixels, TFT_WIDTH * CHAR_HEIGHT );
+  result = result && displaySetting( i, 0, false, WHITE, BLACK );
+  result = result && highlightValue();
+  return result;
+}
+
+
+/**
+ * Ends the editing started by quickEdit(), and tells the application which
+ * part of the display to repaint.
+ */
+bool SettingsMenu::endQuickEdit() {
+  int line = winY;
+  int quickSetting = currentSetting;
+  canUseDisplay = false;
+  quick = false;
+  currentSetting = quickSaved.currentSetting;
+  topSetting = quickSaved.topSetting;
+  editing = quickSaved.editing;
+  winX = quickWindow[0];
+  winY = quickWindow[1];
+  winW = quickWindow[2];
+  winH = quickWindow[3];
+  // the menu may show an old value
+  int row = quickSetting - topSetting;
+  if( row >= 0 && row < winH )
+    staleRows |= 1UL << row;
+  if( repaintFPtr != NULL )
+    return repaintFPtr( 0, line * CHAR_HEIGHT, TFT_WIDTH, CHAR_HEIGHT );
+  return true;
+}
+
+
+/**
+ * settingsGetUiState
+ * 
+ * Gets the selected setting, the first setting on the display and the
+ * value being edited.
+ */
+bool SettingsMenu::getUiState( SettingsUiState *state ) {
+  if( state == NULL || settings == NULL )
+    return false;
+  state->currentSetting = currentSetting;
+  state->topSetting = topSetting;
+  state->editing = editing;
+  state->newValue = settings[currentSetting].newValue;
+  return true;
+}
+
+
+/**
+ * settingsSetUiState
+ * 
+ * Sets the state of the menu, as given by getUiState().
+ */
+bool SettingsMenu::setUiState( const SettingsUiState *state ) {
+  if( state == NULL || settings == NULL || canUseDisplay || batch || editing )
+    return false;
+  int i = state->currentSetting;
+  if( i < 0 || i >= nSettings || settings[i].name == NULL ||
+      state->topSetting < 0 || state->topSetting > i || i >= state->topSetting + winH )
+    return false;
+  Setting *setting = &settings[i];
+  if( state->editing && (state->newValue < 0 || state->newValue >= setting->nValues) )
+    return false;
+  currentSetting = i;
+  topSetting = state->topSetting;
+  editing = state->editing;
+  if( editing && !setting->liveUpdate )
+    setting->newValue = state->newValue;
+  stale = true;
+  return true;
+}
+
+
+/**
+ * Return:
+ * true if the settings library can use the display, see displayOn().
+ */
+bool SettingsMenu::displayed() {
+  return canUseDisplay;
+}
+
+
+/**
+ * settingsWindow
+ * 
+ * Sets the part of the display used by the menu, in characters.
+ */
+bool SettingsMenu::window( int x, int y, int w, int h ) {
+  if( canUseDisplay || x < 0 || y < 0 || w < NAME_COLUMN + VALUE_CHARS + 1 || h < 1 ||
+      x + w > TFT_CHARS || y + h > TFT_LINES )
+    return false;
+  winX = x;
+  winY = y;
+  winW = w;
+  winH = h;
+  // keep the selected setting in the window
+  if( currentSetting >= topSetting + winH )
+    topSetting = currentSetting - winH + 1;
+  stale = true;
+  return true;
+}
+
+
+/**
+ * 
+ */
+bool SettingsMenu::scrollValue( int d ) {
+  bool result = true;
+  Setting *setting = &settings[currentSetting];
+  if( setting == NULL )
+    return false;
+  
+  // determine the new value to select, skipping values
+  // which cannot be applied
+  int currentNewValue = setting->newValue;
+  int newNewValue = nextValue( currentSetting, currentNewValue, d );
+
+  // if it is different than the current value, select it
+  if( newNewValue != currentNewValue ) {
+    setting->newValue = newNewValue;
+    result = result && highlightValue();
+    if( setting->liveUpdate && !batch ) {
+      // save result to be able to reset in settingsOK() if
+      // this value is not accepted for some reason.
+      setting->can = callChange( setting );
+      notifyChange( currentSetting, currentNewValue, newNewValue, setting->can, CHANGE_LIVE );
+      if( setting->can )
+        settingChanged( currentSetting );
+    }
+  }
+
+  return result;
+}
+
+
+/**
+ * Return:
+ * The first value of setting 'i' after 'from' in direction 'd' (1 or -1)
+ * which can be applied, or 'from' if there is none.
+ */
+int SettingsMenu::nextValue( int i, int from, int d ) {
+  Setting *setting = &settings[i];
+  int value = from;
+  do {
+    if( d > 0 && value < setting->nValues-1 )
+      value += d;
+    else if( d < 0 && value > 0 )
+      value += d;
+    else
+      // no acceptable value in this direction
+      return from;
+  } while( !canApply( setting, value ) );
+  return value;
+}
+
+
+/**
+ * Draws setting 'i' with value 'value' on line 'line' of the display, while
+ * the menu is not displayed. With 'clean' false, only the value is drawn.
+ */
+bool SettingsMenu::indicate( int i, int value, int line, bool clean ) {
+  bool result = true;
+  if( i < 0 || i >= nSettings || settings[i].name == NULL || value < 0 || value >= settings[i].nValues ||
+      line < 0 || line >= TFT_LINES )
+    return false;
+  if( canUseDisplay )
+    return result;
+
+  // draw in a window of one line
+  int saved[5] = { winX, winY, winW, winH, topSetting };
+  winX = 0;
+  winY = line;
+  winW = TFT_CHARS;
+  winH = 1;
+  topSetting = i;
+  canUseDisplay = true;
+  if( clean ) {
+    myTFT->fillRect( 0, line * CHAR_HEIGHT, TFT_WIDTH, CHAR_HEIGHT, BLACK );
+    TRACE( TRACE_FILL_RECT, 0, line * CHAR_HEIGHT, TFT_WIDTH, CHAR_HEIGHT, BLACK, NULL );
+    SCREEN_FILL( 0, line, TFT_CHARS, 1 );
+    STATS_ADD( pixels, TFT_WIDTH * CHAR_HEIGHT );
+    result = result && displayName( i, 0, false, WHITE, BLACK );
+  }
+  const char *text = valueText( i, value );
+  int leading = VALUE_CHARS - strlen( text );
+  result = result && printAt( winW - VALUE_CHARS, 0, text, true, value == settings[i].currentValue ? WHITE : RED, 
+                              BLACK, leading > 0 ? leading : 0 );
+  canUseDisplay = false;
+  winX = saved[0];
+  winY = saved[1];
+  winW = saved[2];
+  winH = saved[3];
+  topSetting = saved[4];
+  return result;
+}
+
+
+/**
+ * 
+ */
+bool SettingsMenu::scrollSetting( int d ) {
+  bool result = true;
+  // determine the new setting to select
+  int newSetting = currentSetting;
+  do {
+    if( d > 0 && newSetting < nSettings-1 )
+      newSetting += d;
+    else if( d < 0 && newSetting > 0 )
+      newSetting += d;
+    else
+      return false;
+  } while (settings[newSetting].name == NULL );
+
+  // if it is different than the current setting, select it
+  if( newSetting != currentSetting ) {
+    // unselect the previous current setting ...
+    selectSetting( false );
+    // ... to select the new current setting
+    currentSetting = newSetting;
+    // Is the current setting still visible on the screen?
+    if( currentSetting < topSetting ) {
+      result = result && displaySettings( currentSetting ); 
+    }
+    else if( currentSetting >= topSetting + winH ) {
+      result = result && displaySettings( currentSetting - winH + 1 ); 
+    }
+    selectSetting( true );
+  }
+  return result;
+}
+
+
+/**
+ * To indicate that 'up' has been given.
+ * 
+ * The state machine in this library decides what action to take, change the selected setting,
+ * or change the value of the selected setting.
+ */
+bool SettingsMenu::up() {
+  bool result = true;
+  LATENCY_START();
+  TRACE_CALL( TRACE_UP );
+  if( editing ) {
+      result = result && scrollValue( 1 );
+  } else {
+      result = result && scrollSetting( 1 );
+  }
+  LATENCY_END( LATENCY_UP );
+  return result;
+}
+
+
+/**
+ * To indicate that 'down' has been given.
+ * 
+ * The state machine in this library decides what action to take, change the selected setting,
+ * or change the value of the selected setting.
+ */
+bool SettingsMenu::down() {
+  bool result = true;
+  LATENCY_START();
+  TRACE_CALL( TRACE_DOWN );
+  if( editing ) {
+      result = result && scrollValue( -1 );
+  } else {
+      result = result && scrollSetting( -1 );
+  }
+  LATENCY_END( LATENCY_DOWN );
+  return result;
+}
+
+
+/**
+ * Call to indicate that 'OK' has been given.
+ * 
+ * The state machine in this library decides what action to take, go into edit mode
+ * or save the current value into the selected setting.
+ */
+bool SettingsMenu::ok() {
+  bool result = true;
+  Setting *setting = &settings[currentSetting];
+  int oldValue = setting->currentValue;
+  LATENCY_START();
+  TRACE_CALL( TRACE_OK );
+  if( editing ) {
+    // change value of setting
+    if( batch )
+      // The value will be applied in settingsBatchCommit()
+      setting->pending = setting->newValue != setting->currentValue;
+    else if( setting->newValue != setting->currentValue ) {
+      if( setting->liveUpdate ) {
+        // The setting has already been updated to its new value
+        if( setting->can ) {
+          setting->currentValue = setting->newValue;
+          notifyChange( currentSetting, oldValue, setting->newValue, true, CHANGE_COMMIT );
+        }
+        else {
+          notifyChange( currentSetting, oldValue, setting->newValue, false, CHANGE_COMMIT );
+          setting->newValue = setting->currentValue;
+        }
+      }
+      else if( canApply( setting, setting->newValue ) &&
+               callChange( setting ) ) {
+        setting->currentValue = setting->newValue;
+        notifyChange( currentSetting, oldValue, setting->newValue, true, CHANGE_COMMIT );
+        settingChanged( currentSetting );
+      }
+      else {
+        notifyChange( currentSetting, oldValue, setting->newValue, false, CHANGE_COMMIT );
+        setting->newValue = setting->currentValue;
+      }
+    }
+  } else if( setting->getFPtr != NULL ) {
+    // a read-only setting cannot be edited
+    LATENCY_END( LATENCY_OK );
+    return result;
+  } else {
+    // start editing the value of the current setting
+    // ...?
+  }
+  if( result )
+    editing = !editing;
+  highlightValue();    
+  if( quick && !editing )
+    endQuickEdit();
+  LATENCY_END( LATENCY_OK );
+  return result;
+}
+
+
+/**
+  // Must the value be reset to its current value? This is 
+  // the case when this setting will be updated live AND
+  // the new value != current value AND the new value
+  // has been accepted by the client.
+ */
+bool SettingsMenu::resetNewValue() {
+  bool result = true;
+  Setting *setting = &settings[currentSetting];
+
+  // Must the value be reset to its current value? This is 
+  // the case when this setting will be updated live AND
+  // the new value != current value AND the new value
+  // has been accepted by the client.
+  bool resetLive = setting->liveUpdate && 
+                   !batch &&
+                   setting->can &&
+                   (setting->newValue != setting->currentValue);
+  int liveValue = setting->newValue;
+  setting->newValue = setting->currentValue;
+  setting->pending = false;
+  if( resetLive ) {
+    // Not interested in the result of this call.
+    callChange( setting );
+    notifyChange( currentSetting, liveValue, setting->currentValue, true, CHANGE_RESET );
+    settingChanged( currentSetting );
+  }
+
+  return result;
+}
+
+
+/**
+ * Call to indicate that 'Cancel' has been given.
+ * 
+ * 
+ */
+bool SettingsMenu::stop() {
+  bool result = true;
+  LATENCY_START();
+  TRACE_CALL( TRACE_STOP );
+  if( editing ) {
+    result = result && resetNewValue();
   } else {
     //  Nothing to be done here
   }
+  if( quick ) {
+    editing = false;
+    endQuickEdit();
+  }
+  LATENCY_END( LATENCY_STOP );
+  return result;
+}
+
+
+
+/**
+ * Redisplay the value of setting 'i', if it is on the screen.
+ */
+bool SettingsMenu::redisplayValue( int i ) {
+  bool result = true;
+  // while editing on a single line, the menu shows the value when it is resumed
+  if( quick && i != currentSetting ) {
+    int row = i - quickSaved.topSetting;
+    if( row >= 0 && row < quickWindow[3] )
+      staleRows |= 1UL << row;
+    return result;
+  }
+  int row = i - topSetting;
+  if( row < 0 || row >= winH )
+    return result;
+  if( i == currentSetting )
+    result = result && highlightValue();
+  else
+    result = result && displayValue( i, row, true, WHITE, BLACK );
+  return result;
+}
+
+
+/**
+ * End the batch. When 'accept' is true, the pending values become the
+ * current values, otherwise they are reset to the current values.
+ */
+bool SettingsMenu::endBatch( bool accept ) {
+  bool result = true;
+  for( int i=0; i<nSettings; i++ ) {
+    Setting *setting = &settings[i];
+    if( !setting->pending )
+      continue;
+    int oldValue = setting->currentValue;
+    if( accept ) {
+      setting->currentValue = setting->newValue;
+      markChanged( i );
+    }
+    notifyChange( i, oldValue, setting->newValue, accept, CHANGE_COMMIT );
+    if( !accept )
+      setting->newValue = setting->currentValue;
+    setting->pending = false;
+    result = result && redisplayValue( i );
+  }
+  batch = false;
+  batchFPtr = NULL;
+  refreshDependents();
+  return result;
+}
+
+
+/**
+ * settingsBatchBegin
+ * 
+ * Starts editing a batch of settings.
+ * 
+ * Parameters:
+ * applyFPtr: The function which will be called with all the changed
+ *            settings when the batch is committed.
+ */
+bool SettingsMenu::batchBegin( ApplySettingsFDef applyFPtr ) {
+  if( batch || applyFPtr == NULL )
+    return false;
+  batch = true;
+  batchFPtr = applyFPtr;
+  return true;
+}
+
+
+/**
+ * settingsBatchCommit
+ * 
+ * Applies all the pending values of the batch in one call to the function
+ * given in settingsBatchBegin().
+ */
+bool SettingsMenu::batchCommit() {
+  bool result = true;
+  if( !batch )
+    return false;
+
+  // a setting which is still being edited is part of the batch
+  if( editing ) {
+    Setting *setting = &settings[currentSetting];
+    setting->pending = setting->newValue != setting->currentValue;
+    editing = false;
+    result = result && highlightValue();
+  }
+
+  // collect the changed settings
+  int nChanged = 0;
+  for( int i=0; i<nSettings; i++ )
+    if( settings[i].pending )
+      changeSet[nChanged++] = &settings[i];
+
+  // apply all of them at once, or none of them
+  bool accepted = true;
+  if( nChanged > 0 )
+    accepted = batchFPtr( changeSet, nChanged );
+  result = result && endBatch( accepted );
+  return result && accepted;
+}
+
+
+/**
+ * settingsBatchCancel
+ * 
+ * Resets all the settings in the batch to their current values.
+ */
+bool SettingsMenu::batchCancel() {
+  bool result = true;
+  if( !batch )
+    return false;
+  if( editing ) {
+    settings[currentSetting].newValue = settings[currentSetting].currentValue;
+    editing = false;
+    result = result && highlightValue();
+  }
+  result = result && endBatch( false );
+  return result;
+}
+
+
+/**
+ * Change the value of setting 'i' to 'newIndex' and, if 'call' is true, call
+ * the callback function of the setting. If the value is not accepted, the
+ * setting keeps its current value. The caller must call refreshDependents().
+ */
+bool SettingsMenu::changeValue( int i, int newIndex, bool call ) {
+  bool result = true;
+  Setting *setting = &settings[i];
+  if( newIndex == setting->currentValue )
+    return result;
+  if( newIndex < 0 || newIndex >= setting->nValues || (call && !canApply( setting, newIndex )) )
+    return false;
+  setting->newValue = newIndex;
+  if( !call || (setting->fPtr != NULL && callChange( setting )) ) {
+    int oldValue = setting->currentValue;
+    setting->currentValue = newIndex;
+    notifyChange( i, oldValue, newIndex, true, CHANGE_COMMIT );
+    markChanged( i );
+  }
+  else {
+    notifyChange( i, setting->currentValue, newIndex, false, CHANGE_COMMIT );
+    setting->newValue = setting->currentValue;
+    result = false;
+  }
+  redisplayValue( i );
+  return result;
+}
+
+
+/**
+ * settingsApplyPreset
+ * 
+ * Applies the values of a preset.
+ * 
+ * Parameters:
+ * preset:    The preset to apply
+ */
+bool SettingsMenu::applyPreset( const Preset *preset ) {
+  bool result = true;
+  if( preset == NULL || batch )
+    return false;
+  int n = preset->nValues;
+  if( n > nSettings )
+    n = nSettings;
+  for( int i=0; i<n; i++ ) {
+    unsigned char value = preset->values[i];
+    if( value == PRESET_KEEP || settings[i].name == NULL )
+      continue;
+    // the setting being edited keeps its value, as in setValue()
+    if( editing && i == currentSetting ) {
+      result = false;
+      continue;
+    }
+    // continue with the other settings if one is not accepted
+    result = changeValue( i, value, true ) && result;
+  }
+  // refresh the dependent settings once for the whole preset
+  refreshDependents();
+  return result;
+}
+
+
+/**
+ * settingsStorePreset
+ * 
+ * Stores the current values of the settings in 'values'. A value with an
+ * index of PRESET_KEEP or more does not fit, PRESET_KEEP is stored instead.
+ */
+bool SettingsMenu::storePreset( unsigned char *values, int nValues ) {
+  bool result = true;
+  if( values == NULL )
+    return false;
+  for( int i=0; i<nValues; i++ )
+    if( i < nSettings && settings[i].name != NULL && settings[i].currentValue < PRESET_KEEP )
+      values[i] = settings[i].currentValue;
+    else {
+      // a value which does not fit in a preset is not stored
+      if( i < nSettings && settings[i].name != NULL )
+        result = false;
+      values[i] = PRESET_KEEP;
+    }
+  return result;
+}
+
+
+/**
+ * settingsApplyAll
+ * 
+ * Calls the ChangeSettingFDef of every setting once with its current value,
+ * the settings it depends on first.
+ * 
+ * Parameters:
+ * hookFPtr:  If not NULL, called before and after all settings are applied
+ * elapsed:   If not NULL, receives the time it took in microseconds
+ */
+bool SettingsMenu::applyAll( ApplyAllFDef hookFPtr, unsigned long *elapsed ) {
+  bool result = true;
+  if( marks == NULL || batch )
+    return false;
+  unsigned long start = micros();
+
+  // the order in which the settings are created, with the dependencies first
+  nOrder = 0;
+  for( int i=0; i<nSettings; i++ )
+    if( !(marks[i] & MARK_VISITED) )
+      visitDependencies( i );
+  memset( marks, 0, nSettings );
+
+  if( hookFPtr != NULL )
+    result = hookFPtr( true ) && result;
+  for( int o=0; o<nOrder; o++ ) {
+    Setting *setting = &settings[order[o]];
+    // the setting being edited is applied when the editing ends
+    if( editing && order[o] == currentSetting ) {
+      result = false;
+      continue;
+    }
+    if( setting->refreshFPtr != NULL )
+      result = ((RefreshSettingFDef) setting->refreshFPtr)(setting) && result;
+    setting->newValue = setting->currentValue;
+    if( setting->fPtr != NULL )
+      result = callChange( setting ) && result;
+  }
+  if( hookFPtr != NULL )
+    result = hookFPtr( false ) && result;
+
+  if( elapsed != NULL )
+    *elapsed = micros() - start;
+  return result;
+}
+
+
+/**
+ * The number of settings in the menu, including empty lines.
+ */
+int SettingsMenu::count() {
+  return nSettings;
+}
+
+
+/**
+ * Return:
+ * Setting 'i', or NULL if there is no such setting.
+ */
+Setting *SettingsMenu::setting( int i ) {
+  if( i < 0 || i >= nSettings )
+    return NULL;
+  return &settings[i];
+}
+
+
+/**
+ * Return:
+ * The index of 'setting' in this menu, or -1 if it is not in this menu.
+ */
+int SettingsMenu::index( Setting *setting ) {
+  if( setting == NULL || settings == NULL || setting < settings || setting >= settings + nSettings )
+    return -1;
+  return setting - settings;
+}
+
+
+/**
+ * Return:
+ * The index of the setting of which settingsHash( name ) == 'hash',
+ * or -1 if there is no such setting.
+ */
+int SettingsMenu::find( unsigned long hash ) {
+  if( nameIndex == NULL )
+    return -1;
+  for( int slot = hash & (nNameIndex - 1); nameIndex[slot].setting >= 0; slot = (slot + 1) & (nNameIndex - 1) )
+    if( nameIndex[slot].hash == hash )
+      return nameIndex[slot].setting;
+  return -1;
+}
+
+
+/**
+ * Return:
+ * The index of the setting with name 'name', or -1 if there is no such setting.
+ */
+int SettingsMenu::find( const char *name ) {
+  if( name == NULL || nameIndex == NULL )
+    return -1;
+  unsigned long hash = settingsHash( name );
+  for( int slot = hash & (nNameIndex - 1); nameIndex[slot].setting >= 0; slot = (slot + 1) & (nNameIndex - 1) )
+    if( nameIndex[slot].hash == hash && strcmp( settings[nameIndex[slot].setting].name, name ) == 0 )
+      return nameIndex[slot].setting;
+  return -1;
+}
+
+
+/**
+ * Return:
+ * The index of the value of setting 'i' of which settingsHash( value ) == 'hash',
+ * or -1 if there is no such value.
+ */
+int SettingsMenu::findValue( int i, unsigned long hash ) {
+  if( i < 0 || i >= nSettings )
+    return -1;
+  if( i >= indexedSettings || settings[i].provider != NULL || settings[i].getFPtr != NULL ) {
+    // the values are not in the index
+    for( int v=0; v<settings[i].nValues; v++ )
+      if( settingsHash( valueText( i, v ) ) == hash )
+        return v;
+    return -1;
+  }
+  for( int slot = (hash + i * 2654435761UL) & (nValueIndex - 1); valueIndex[slot].setting >= 0; slot = (slot + 1) & (nValueIndex - 1) )
+    if( valueIndex[slot].hash == hash && valueIndex[slot].setting == i )
+      return valueIndex[slot].value;
+  return -1;
+}
+
+
+/**
+ * Return:
+ * The index of value 'value' of setting 'i', or -1 if there is no such value.
+ */
+int SettingsMenu::findValue( int i, const char *value ) {
+  if( i < 0 || i >= nSettings || value == NULL )
+    return -1;
+  if( i >= indexedSettings || settings[i].provider != NULL || settings[i].getFPtr != NULL ) {
+    // the values are not in the index
+    for( int v=0; v<settings[i].nValues; v++ )
+      if( strcmp( valueText( i, v ), value ) == 0 )
+        return v;
+    return -1;
+  }
+  unsigned long hash = settingsHash( value );
+  for( int slot = (hash + i * 2654435761UL) & (nValueIndex - 1); valueIndex[slot].setting >= 0; slot = (slot + 1) & (nValueIndex - 1) )
+    if( valueIndex[slot].hash == hash && valueIndex[slot].setting == i &&
+        strcmp( valueText( i, valueIndex[slot].value ), value ) == 0 )
+      return valueIndex[slot].value;
+  return -1;
+}
+
+
+/**
+ * Change the value of setting 'i' to 'newIndex', and apply it in the same
+ * way as settingsOK() does. With 'call' false, the ChangeSettingFDef is not
+ * called, for a value which has already been applied by the application.
+ * This is not possible for the setting which is being edited, nor during 
+ * a batch. The value is only redrawn when it is on the display.
+ * 
+ * Return:
+ * true if the value has been accepted, false if not
+ */
+bool SettingsMenu::setValue( int i, int newIndex, bool call ) {
+  bool result = true;
+  if( i < 0 || i >= nSettings || settings[i].name == NULL )
+    return false;
+  if( batch || (editing && i == currentSetting) )
+    return false;
+  result = result && changeValue( i, newIndex, call );
+  refreshDependents();
   return result;
 }
 
+
+/**
+ * Adds a function which will be called after every change of a value.
+ * 
+ * Parameters:
+ * listener:  The function to call
+ * context:   Passed to 'listener', e.g. an object
+ * 
+ * Return:
+ * false if there are already MAX_LISTENERS listeners
+ */
+bool SettingsMenu::addListener( SettingsListenerFDef listener, void *context ) {
+  if( listener == NULL || nListeners == MAX_LISTENERS )
+    return false;
+  listeners[nListeners] = listener;
+  contexts[nListeners] = context;
+  nListeners++;
+  return true;
+}
+
+
+/**
+ * Tell the listeners that the value of setting 'i' has been changed.
+ */
+void SettingsMenu::notifyChange( int i, int oldValue, int newValue, bool accepted, unsigned char kind ) {
+  if( nListeners == 0 )
+    return;
+  SettingsChange change;
+  change.setting = &settings[i];
+  change.index = i;
+  change.oldValue = oldValue;
+  change.newValue = newValue;
+  change.accepted = accepted;
+  change.kind = kind;
+  change.millis = millis();
+  for( int l=0; l<nListeners; l++ )
+    listeners[l]( contexts[l], &change );
+}
+
+
+/**
+ * settingsHash
+ * 
+ * 32 bit FNV-1a hash of 'text'.
+ */
+unsigned long settingsHash( const char *text ) {
+  unsigned long hash = 2166136261UL;
+  if( text == NULL )
+    return 0;
+  for( ; *text; text++ ) {
+    hash ^= (unsigned char) *text;
+    hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+  }
+  return hash;
+}
+
+
+/**
+ * settingsCrc
+ * 
+ * Updates a CRC-8 (polynomial 0x07) with one byte.
+ */
+unsigned char settingsCrc( unsigned char crc, unsigned char data ) {
+  crc ^= data;
+  for( int i=0; i<8; i++ )
+    crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+  return crc;
+}
+
+
+/*
+ * The functions below use the default menu 'settingsMenu'.
+ * See the methods of SettingsMenu for their descriptions.
+ */
+
+bool initSettings( int n, ST7735_t3 *tft, int nValues ) {
+  return settingsMenu.init( n, tft, nValues );
+}
+
+Setting *createSetting( char *text, char **values, int nValues, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr ) {
+  return settingsMenu.createSetting( text, values, nValues, currentValue, liveUpdate, setFPtr );
+}
+
+bool addDependency( Setting *setting, Setting *dependsOn ) {
+  return settingsMenu.addDependency( setting, dependsOn );
+}
+
+Setting *createProvidedSetting( char *text, const ValueProvider *provider, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr ) {
+  return settingsMenu.createProvidedSetting( text, provider, currentValue, liveUpdate, setFPtr );
+}
+
+bool settingsValuesChanged( Setting *setting ) {
+  return settingsMenu.valuesChanged( setting );
+}
+
+Setting *createTelemetry( char *text, TelemetryFDef getFPtr ) {
+  return settingsMenu.createTelemetry( text, getFPtr );
+}
+
+bool settingsTelemetryInterval( unsigned long interval ) {
+  return settingsMenu.telemetryInterval( interval );
+}
+
+bool settingsPollTelemetry() {
+  return settingsMenu.pollTelemetry();
+}
+
+bool settingsDisplayOn() {
+  return settingsMenu.displayOn();
+}
+
+bool settingsDisplayOff() {
+  return settingsMenu.displayOff();
+}
+
+bool settingsDisplayResume( int x, int y, int w, int h ) {
+  return settingsMenu.displayResume( x, y, w, h );
+}
+
+bool settingsGetUiState( SettingsUiState *state ) {
+  return settingsMenu.getUiState( state );
+}
+
+bool settingsWindow( int x, int y, int w, int h ) {
+  return settingsMenu.window( x, y, w, h );
+}
+
+bool settingsSet( Setting *setting, int index, bool notify ) {
+  return settingsMenu.setValue( settingsMenu.index( setting ), index, notify );
+}
+
+bool settingsQuickEdit( Setting *setting, int line, RepaintFDef repaintFPtr ) {
+  return settingsMenu.quickEdit( setting, line, repaintFPtr );
+}
+
+bool settingsSetUiState( const SettingsUiState *state ) {
+  return settingsMenu.setUiState( state );
+}
+
+bool settingsUp() {
+  return settingsMenu.up();
+}
+
+bool settingsDown() {
+  return settingsMenu.down();
+}
+
+bool settingsOK() {
+  return settingsMenu.ok();
+}
+
+bool settingsStop() {
+  return settingsMenu.stop();
+}
+
+bool settingsBatchBegin( ApplySettingsFDef applyFPtr ) {
+  return settingsMenu.batchBegin( applyFPtr );
+}
+
+bool settingsBatchCommit() {
+  return settingsMenu.batchCommit();
+}
+
+bool settingsBatchCancel() {
+  return settingsMenu.batchCancel();
+}
+
+bool settingsApplyPreset( const Preset *preset ) {
+  return settingsMenu.applyPreset( preset );
+}
+
+bool settingsStorePreset( unsigned char *values, int nValues ) {
+  return settingsMenu.storePreset( values, nValues );
+}
+
+bool settingsApplyAll( ApplyAllFDef hookFPtr, unsigned long *elapsed ) {
+  return settingsMenu.applyAll( hookFPtr, elapsed );
+}
+
+#ifdef SETTINGS_TIMING
+bool settingsTiming( Setting *setting, SettingTiming *timing ) {
+  return settingsMenu.timing( setting, timing );
+}
+
+bool settingsTimingReset() {
+  return settingsMenu.timingReset();
+}
+
+bool settingsTimingDump( Print *out ) {
+  return settingsMenu.timingDump( out );
+}
+#endif
+
+#ifdef SETTINGS_STATS
+SettingsStats settingsStats() {
+  return settingsMenu.stats();
+}
+
+bool settingsStatsReset() {
+  return settingsMenu.statsReset();
+}
+#endif
+
+#ifdef SETTINGS_LATENCY
+bool settingsInputStamp( unsigned long stamp ) {
+  return settingsMenu.inputStamp( stamp );
+}
+
+bool settingsLatency( int event, SettingsLatency *latency ) {
+  return settingsMenu.latency( event, latency );
+}
+
+bool settingsLatencyReset() {
+  return settingsMenu.latencyReset();
+}
+#endif
+
+#ifdef SETTINGS_TRACE
+bool settingsTraceDump( Print *out ) {
+  return settingsMenu.traceDump( out );
+}
+
+bool settingsTraceClear() {
+  return settingsMenu.traceClear();
+}
+
+bool settingsTraceReplay( Stream *in ) {
+  return settingsMenu.traceReplay( in );
+}
+#endif
+
+#ifdef SETTINGS_SCREEN
+bool settingsScreenDump( Print *out ) {
+  return settingsMenu.screenDump( out );
+}
+
+int settingsScreenCompare( const char * const *expected, Print *diff ) {
+  return settingsMenu.screenCompare( expected, diff );
+}
+#endif
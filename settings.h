@@ -16,19 +16,62 @@
 #define _settings_h_
 
 #include <ST7735_t3.h>       // Hardware-specific library for the ST7735 LCD controller
+#include "st7735_properties.h"
 
+// Uncomment to measure the time spent in the callback functions of the 
+// settings, see settingsTiming(). 
+// #define SETTINGS_TIMING
+
+// Uncomment to count the drawing and the callbacks done by the library,
+// see settingsStats().
+// #define SETTINGS_STATS
+
+// Uncomment to measure the time from an input event (settingsUp() etc.)
+// until the display has been updated, see settingsLatency().
+// #define SETTINGS_LATENCY
+
+// Uncomment to record the calls to the library and the drawing done by the 
+// library in a ring buffer, see settingsTraceDump().
+// #define SETTINGS_TRACE
+
+// Uncomment to keep a model of the characters drawn on the screen by the
+// library, to compare it with the expected screen, see settingsScreenCompare().
+// #define SETTINGS_SCREEN
+
+
+struct ValueProviders;
 
 typedef struct Settings {
   char *name;
-  char **values;
+  char **values;      // NULL if the values are given by 'provider'
   int nValues;        // number of values in 'values'
   int currentValue;   // index into 'values'
   int newValue;       // index into 'values'
   void *fPtr;
+  void *canFPtr;      // optional CanApplySettingFDef, NULL if all values are allowed
+  void *refreshFPtr;  // optional RefreshSettingFDef, called when a setting it depends on has changed
+  void *getFPtr;      // TelemetryFDef of a read-only setting, see createTelemetry(), otherwise NULL
+  const struct ValueProviders *provider;  // gives the values, see createProvidedSetting(), otherwise NULL
   bool liveUpdate;
   bool can;
+  bool pending;       // changed in a batch, but not yet applied
 } Setting;
 
+/*
+ * A preset holds a value for a number of settings, to be able to switch 
+ * a group of settings at once (e.g. to change the operating mode).
+ * The values are indices into the 'values' of the settings, in the order in 
+ * which the settings have been created, below PRESET_KEEP. A preset can be 
+ * declared const, so it will be kept in flash.
+ */
+#define PRESET_KEEP 0xFF  // the value of the setting will not be changed
+
+typedef struct SettingsPresets {
+  const char *name;
+  const unsigned char *values;  // index into 'values' for each setting, or PRESET_KEEP
+  int nValues;                  // number of values in 'values'
+} Preset;
+
 /*
  * Such a function will be called by the library when the value for a setting
  * has been changed. 
@@ -42,6 +85,511 @@ typedef struct Settings {
  */
 typedef bool (*ChangeSettingFDef) (Setting *setting);
 
+/*
+ * Such a function can be given to the library to check if a value for a setting
+ * is acceptable, before the (possibly expensive) ChangeSettingFDef is called.
+ * It should be cheap and must not change anything in the program.
+ * 
+ * Parameters:
+ * setting:       The setting for which the value would be changed
+ * newIndex:      Index into 'values' of the value which would be applied
+ * 
+ * Return:
+ * true if the value can be applied, false if not
+ * 
+ */
+typedef bool (*CanApplySettingFDef) (Setting *setting, int newIndex);
+
+/*
+ * Such a function will be called by the library when the value of a setting
+ * on which 'setting' depends (see addDependency()) has been changed. It can
+ * be used to recompute state in the program which is derived from more than
+ * one setting. 
+ * 
+ * Parameters:
+ * setting:       The setting which depends on the changed setting(s)
+ * 
+ * Return:
+ * true if the recompute succeeded, false if not
+ * 
+ */
+typedef bool (*RefreshSettingFDef) (Setting *setting);
+
+/*
+ * Such a function will be called by the library when a batch of settings
+ * has been changed (see settingsBatchBegin()). It is called once for all
+ * the changed settings together. The new values are in 'newValue' of the
+ * settings, the old values are still in 'currentValue'.
+ * 
+ * Parameters:
+ * changed:       The settings for which the value has been changed
+ * nChanged:      The number of settings in 'changed'
+ * 
+ * Return:
+ * true if all the new values have been accepted, false if none have
+ * 
+ */
+typedef bool (*ApplySettingsFDef) (Setting **changed, int nChanged);
+
+/*
+ * Such a function gives the value of a read-only setting, see createTelemetry().
+ * It is called by settingsPollTelemetry(). It must be quick.
+ * 
+ * Parameters:
+ * setting:       The setting
+ * text:          Receives the value as text
+ * size:          Size of 'text', including the terminating '\0'
+ * 
+ * Return:
+ * false if there is no value now, the previous value is kept
+ */
+typedef bool (*TelemetryFDef) (Setting *setting, char *text, int size);
+
+/*
+ * Gives the values of a setting of which the values are not known in advance
+ * or are too many to keep in memory, e.g. the files on an SD card. See
+ * createProvidedSetting(). The functions must be quick.
+ */
+typedef int (*ValueCountFDef) (Setting *setting);
+typedef bool (*ValueTextFDef) (Setting *setting, int index, char *text, int size);
+
+typedef struct ValueProviders {
+  ValueCountFDef countFPtr;   // returns the number of values
+  ValueTextFDef textFPtr;     // puts the text of value 'index' in 'text', of 'size' bytes
+} ValueProvider;
+
+// The number of values of provided settings kept by a menu
+#ifndef PROVIDER_CACHE
+#define PROVIDER_CACHE 8
+#endif
+
+// Size of the text of a provided value, including the '\0'
+#ifndef PROVIDER_TEXT
+#define PROVIDER_TEXT 16
+#endif
+
+// Size of the text of the value of a read-only setting, including the '\0'
+#ifndef TELEMETRY_TEXT
+#define TELEMETRY_TEXT 12
+#endif
+
+// Default time in milliseconds between updates of read-only settings
+#ifndef TELEMETRY_INTERVAL
+#define TELEMETRY_INTERVAL 250
+#endif
+
+/*
+ * Such a function can be given to settingsApplyAll(). It is called with
+ * 'begin' true before the ChangeSettingFDef's of all settings are called,
+ * and with 'begin' false after that, e.g. to compute the filters of a DSP
+ * chain only once.
+ * 
+ * Parameters:
+ * begin:         true before the settings are applied, false after
+ * 
+ */
+typedef bool (*ApplyAllFDef) (bool begin);
+
+/*
+ * Such a function can be given to settingsQuickEdit(). It is called when
+ * the editing has ended, with the part of the display which the application
+ * must repaint, in pixels.
+ * 
+ * Parameters:
+ * x, y:          The top left corner
+ * w, h:          The width and height
+ * 
+ */
+typedef bool (*RepaintFDef) (int x, int y, int w, int h);
+
+/*
+ * The state of the menu on the display, see settingsGetUiState().
+ */
+typedef struct SettingsUiStates {
+  int currentSetting;     // index of the selected setting
+  int topSetting;         // index of the setting on the first line
+  bool editing;           // the selected setting is being edited
+  int newValue;           // index into 'values' of the value being edited
+} SettingsUiState;
+
+/*
+ * A change of the value of a setting, passed to a SettingsListenerFDef.
+ */
+#define CHANGE_COMMIT 0   // value accepted (or not) with settingsOK(), a batch, a preset or setValue()
+#define CHANGE_LIVE 1     // value applied (or not) while editing a setting with liveUpdate
+#define CHANGE_RESET 2    // live value reset to the current value with settingsStop()
+#define CHANGE_LIMIT 3    // current value limited by settingsValuesChanged()
+
+typedef struct SettingsChanges {
+  Setting *setting;
+  int index;              // index of 'setting' in its menu
+  int oldValue;           // index into 'values' of the value before the change
+  int newValue;           // index into 'values' of the value after the change
+  bool accepted;          // false if the ChangeSettingFDef did not accept 'newValue'
+  unsigned char kind;     // CHANGE_COMMIT, CHANGE_LIVE, CHANGE_RESET or CHANGE_LIMIT
+  unsigned long millis;   // time of the change
+} SettingsChange;
+
+/*
+ * Such a function will be called by the library after a ChangeSettingFDef
+ * has been called, see SettingsMenu::addListener(). When the change has been
+ * accepted, 'currentValue' of the setting already is the new value. 
+ * It must be quick.
+ * 
+ * Parameters:
+ * context:       The context given to addListener()
+ * change:        The change
+ * 
+ */
+typedef void (*SettingsListenerFDef) (void *context, const SettingsChange *change);
+
+// The maximum number of listeners of a menu
+#ifndef MAX_LISTENERS
+#define MAX_LISTENERS 4
+#endif
+
+#ifdef SETTINGS_TIMING
+/*
+ * Timing of the calls to the ChangeSettingFDef of a setting. All times are
+ * in microseconds. Bucket i of the histogram counts the calls which took 
+ * between 2^i and 2^(i+1) microseconds, the last bucket counts all longer calls.
+ */
+#define TIMING_BUCKETS 12
+
+typedef struct SettingTimings {
+  unsigned long count;      // number of calls
+  unsigned long minMicros;
+  unsigned long maxMicros;
+  unsigned long totalMicros;
+  unsigned long buckets[TIMING_BUCKETS];
+} SettingTiming;
+#endif
+
+#ifdef SETTINGS_STATS
+/*
+ * Counters of the work done by the library. All times are in microseconds.
+ */
+typedef struct SettingsStatistics {
+  unsigned long redraws;          // full redraws of the settings
+  unsigned long repaints;         // repaints of the selected value
+  unsigned long pixels;           // pixels filled to clear the background
+  unsigned long glyphs;           // characters drawn
+  unsigned long callbacks;        // calls to a ChangeSettingFDef
+  unsigned long redrawMicros;
+  unsigned long repaintMicros;
+  unsigned long printMicros;      // time spent printing text, also part of the above
+  unsigned long callbackMicros;
+} SettingsStats;
+#endif
+
+#ifdef SETTINGS_LATENCY
+/*
+ * Latency from an input event until the display has been updated, in 
+ * microseconds, up to the end of the last drawing for the event. The percentiles are over the last LATENCY_SAMPLES events
+ * which updated the display, the maximum is over all of them.
+ */
+#define LATENCY_UP 0
+#define LATENCY_DOWN 1
+#define LATENCY_OK 2
+#define LATENCY_STOP 3
+#define LATENCY_EVENTS 4
+
+#define LATENCY_SAMPLES 32
+
+typedef struct SettingsLatencies {
+  unsigned long count;      // number of events which updated the display
+  unsigned long p50Micros;
+  unsigned long p99Micros;
+  unsigned long maxMicros;
+} SettingsLatency;
+#endif
+
+#ifdef SETTINGS_TRACE
+// The number of records in the trace of a menu, an even number
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 128
+#endif
+
+// The number of characters of a printed text which are kept in the trace
+#ifndef TRACE_TEXT
+#define TRACE_TEXT TFT_CHARS
+#endif
+
+typedef struct TraceRecords {
+  unsigned long micros;
+  char op;
+  short x, y, w, h;
+  unsigned short color;
+  short length;           // number of characters in 'text', -1 if there is no text
+  char text[TRACE_TEXT];  // copy of the printed text, only for TRACE_PRINT
+} TraceRecord;
+
+// The state of a menu before a record of the trace
+typedef struct TraceStates {
+  bool valid;
+  unsigned long count;    // number of records before it
+  unsigned long micros;
+  bool displayed;
+  SettingsUiState ui;
+  int nValues;
+  int *values;            // the current value of each setting
+} TraceState;
+#endif
+
+#ifdef SETTINGS_SCREEN
+/*
+ * The screen model has one line per text line of the display. Each line has
+ * TFT_CHARS characters, a '|', and the color of each of these characters:
+ * ' ' black, 'W' white, 'B' blue, 'R' red, 'G' green, 'C' cyan, 'M' magenta,
+ * 'Y' yellow, '?' any other color. A character drawn over another character,
+ * without clearing the background first, is shown as '#'. A character which
+ * is only partly cleared stays in the model.
+ * 
+ * The model is kept per character, not per pixel: it shows text which has
+ * not been cleared, or drawn in the wrong place or color, but not drawing
+ * errors within a character, and the background is taken to be black.
+ */
+#define SCREEN_LINE_LENGTH (2 * TFT_CHARS + 1)
+#endif
+
+// The number of values per setting for which there is room in the index of
+// the values, when init() is not given the number of values
+#ifndef INDEX_VALUES
+#define INDEX_VALUES 4
+#endif
+
+// The maximum number of dependencies between settings in a menu
+#ifndef MAX_DEPENDENCIES
+#define MAX_DEPENDENCIES 32
+#endif
+
+typedef struct Dependencies {
+  int setting;    // index of the dependent setting
+  int dependsOn;  // index of the setting it depends on
+} Dependency;
+
+// An entry in the hashed indices of names and values
+typedef struct HashKeys {
+  unsigned long hash;   // settingsHash() of the name or value
+  int setting;          // index of the setting, -1 for an empty entry
+  int value;            // index into 'values' of the setting
+} HashKey;
+
+// A value of a provided setting, kept in the cache of the menu
+typedef struct ValueCaches {
+  int setting;          // index of the setting, -1 for an empty entry
+  int value;            // index of the value
+  char text[PROVIDER_TEXT];
+} ValueCache;
+
+#ifdef SETTINGS_LATENCY
+typedef struct LatencyLogs {
+  unsigned long samples[LATENCY_SAMPLES];  // ring of the last latencies
+  int next;                                // next sample to overwrite
+  unsigned long count;
+  unsigned long maxMicros;
+} LatencyLog;
+#endif
+
+/*
+ * A menu of settings on a display. Each menu has its own settings and
+ * state, so more than one menu can be used, e.g. on different displays.
+ * The functions outside of this class (initSettings(), settingsUp() etc.)
+ * use the menu 'settingsMenu'. The methods do the same as these functions.
+ */
+class SettingsMenu {
+public:
+  SettingsMenu();
+
+  bool init( int n, ST7735_t3 *tft, int nValues = 0 );       // see initSettings()
+  Setting *createSetting( char *text, char **values, int nValues, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr );
+  bool addDependency( Setting *setting, Setting *dependsOn );
+  Setting *createTelemetry( char *text, TelemetryFDef getFPtr ); // see createTelemetry()
+  Setting *createProvidedSetting( char *text, const ValueProvider *provider, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr );
+  bool valuesChanged( Setting *setting );                    // see settingsValuesChanged()
+  bool telemetryInterval( unsigned long interval );          // see settingsTelemetryInterval()
+  bool pollTelemetry();                                      // see settingsPollTelemetry()
+
+  bool displayOn();                                          // see settingsDisplayOn()
+  bool displayOff();                                         // see settingsDisplayOff()
+  bool displayed();                                          // true between displayOn() and displayOff()
+  bool displayResume( int x, int y, int w, int h );          // see settingsDisplayResume()
+  bool window( int x, int y, int w, int h );                 // see settingsWindow()
+  bool quickEdit( Setting *setting, int line, RepaintFDef repaintFPtr ); // see settingsQuickEdit()
+  bool getUiState( SettingsUiState *state );                 // see settingsGetUiState()
+  bool setUiState( const SettingsUiState *state );           // see settingsSetUiState()
+  bool up();                                                 // see settingsUp()
+  bool down();                                               // see settingsDown()
+  bool ok();                                                 // see settingsOK()
+  bool stop();                                               // see settingsStop()
+
+  bool batchBegin( ApplySettingsFDef applyFPtr );            // see settingsBatchBegin()
+  bool batchCommit();                                        // see settingsBatchCommit()
+  bool batchCancel();                                        // see settingsBatchCancel()
+  bool applyPreset( const Preset *preset );                  // see settingsApplyPreset()
+  bool storePreset( unsigned char *values, int nValues );    // see settingsStorePreset()
+  bool applyAll( ApplyAllFDef hookFPtr, unsigned long *elapsed ); // see settingsApplyAll()
+
+  int count();                                               // number of settings, including empty lines
+  Setting *setting( int i );                                 // setting 'i', or NULL
+  int index( Setting *setting );                             // index of 'setting', or -1
+  const char *valueText( int i, int value );                 // text of value 'value' of setting 'i', "" if there is none;
+                                                             // of a provided setting only valid until the next call
+  int find( unsigned long hash );                            // index of the setting with settingsHash( name ) == 'hash', or -1
+  int find( const char *name );                              // index of the setting with this name, or -1
+  int findValue( int i, unsigned long hash );                // index of the value of setting 'i' with settingsHash( value ) == 'hash', or -1
+  int findValue( int i, const char *value );                 // index of this value of setting 'i', or -1
+  bool setValue( int i, int newIndex, bool call = true );    // see settingsSet()
+  int nextValue( int i, int from, int d );                   // next value of setting 'i' in direction 'd' which can be applied
+  bool indicate( int i, int value, int line, bool clean );   // draw setting 'i' with 'value' on 'line' while the menu is not displayed
+  bool addListener( SettingsListenerFDef listener, void *context ); // call 'listener' on every change of a value
+
+#ifdef SETTINGS_TIMING
+  bool timing( Setting *setting, SettingTiming *timing );    // see settingsTiming()
+  bool timingReset();                                        // see settingsTimingReset()
+  bool timingDump( Print *out );                             // see settingsTimingDump()
+#endif
+#ifdef SETTINGS_STATS
+  SettingsStats stats();                                     // see settingsStats()
+  bool statsReset();                                         // see settingsStatsReset()
+#endif
+#ifdef SETTINGS_LATENCY
+  bool inputStamp( unsigned long stamp );                    // see settingsInputStamp()
+  bool latency( int event, SettingsLatency *latency );       // see settingsLatency()
+  bool latencyReset();                                       // see settingsLatencyReset()
+#endif
+#ifdef SETTINGS_TRACE
+  bool traceDump( Print *out );                              // see settingsTraceDump()
+  bool traceClear();                                         // see settingsTraceClear()
+  bool traceReplay( Stream *in );                            // see settingsTraceReplay()
+#endif
+#ifdef SETTINGS_SCREEN
+  bool screenDump( Print *out );                             // see settingsScreenDump()
+  int screenCompare( const char * const *expected, Print *diff ); // see settingsScreenCompare()
+#endif
+
+private:
+  bool canUseDisplay;
+  bool stale;           // the whole menu must be drawn again, e.g. after the window has changed
+  unsigned long staleRows; // a bit per row of the window which has not been drawn because the display could not be used
+  ST7735_t3 *myTFT;
+  int maxSettings;      // The maximum allowed number of settings.
+  int nSettings;        // The number of Setting's in 'settings'.
+  Setting *settings;    // the array of Setting's
+  int currentSetting;   // index of the currently selected setting
+  int topSetting;       // the topmost setting which is currently displayed.
+  int winX, winY;       // top left of the part of the display used by the menu, in characters
+  int winW, winH;       // width and height of that part, in characters
+  bool quick;           // a setting is edited with settingsQuickEdit()
+  RepaintFDef repaintFPtr;      // given to settingsQuickEdit()
+  SettingsUiState quickSaved;   // the state of the menu before settingsQuickEdit()
+  int quickWindow[4];           // the window of the menu before settingsQuickEdit()
+  unsigned long telemetryMillis;  // time between updates of read-only settings
+  unsigned long lastTelemetry;    // millis() of the last update
+  bool editing;         // the currently selected setting is being edited now
+  bool batch;           // values are collected in a batch, see settingsBatchBegin()
+  ApplySettingsFDef batchFPtr; // to be called on settingsBatchCommit()
+  Setting **changeSet;  // the changed settings, passed to 'batchFPtr'
+
+  Dependency dependencies[MAX_DEPENDENCIES];
+  int nDependencies;
+  unsigned char *marks; // per setting marks, used to walk the dependencies
+  int *order;           // settings to refresh, in reverse order
+  int nOrder;
+
+  HashKey *nameIndex;   // hashed index of the names of the settings
+  int nNameIndex;       // size of 'nameIndex', a power of 2
+  HashKey *valueIndex;  // hashed index of the values of the settings
+  int nValueIndex;      // size of 'valueIndex', a power of 2
+  int nIndexed;         // number of values in 'valueIndex', at most half of its size
+  int indexedSettings;  // the values of the settings before this one are in 'valueIndex'
+  ValueCache cache[PROVIDER_CACHE]; // values of provided settings, value v in entry v % PROVIDER_CACHE
+
+  SettingsListenerFDef listeners[MAX_LISTENERS];
+  void *contexts[MAX_LISTENERS];  // passed to the listeners
+  int nListeners;
+
+#ifdef SETTINGS_TIMING
+  SettingTiming *timings;  // timing per setting
+#endif
+#ifdef SETTINGS_STATS
+  SettingsStats statistics;
+#endif
+#ifdef SETTINGS_LATENCY
+  LatencyLog latencies[LATENCY_EVENTS];
+  unsigned long eventStart; // start time of the current event
+  bool stamped;             // 'eventStart' has been given by settingsInputStamp()
+  bool drawn;               // the display has been updated for the current event
+  unsigned long drawnMicros; // end of the last drawing for the current event
+#endif
+#ifdef SETTINGS_TRACE
+  TraceRecord *trace;       // ring of TRACE_RECORDS records
+  unsigned long traceCount; // number of records since the trace was cleared
+  TraceState traceStates[2]; // the state at the first call in the last two halves of the ring
+  int traceLast;            // the last state kept in 'traceStates', -1 if none
+  bool traceDue;            // the state must be kept at the next call
+#endif
+#ifdef SETTINGS_SCREEN
+  char screen[TFT_LINES][SCREEN_LINE_LENGTH + 1]; // what has been drawn
+#endif
+
+  bool dependsOnPath( int from, int to );
+  void visitDependents( int i );
+  void visitDependencies( int i );
+  void markChanged( int i );
+  bool refreshDependents();
+  bool settingChanged( int i );
+  bool callChange( Setting *setting );
+  void notifyChange( int i, int oldValue, int newValue, bool accepted, unsigned char kind );
+#ifdef SETTINGS_LATENCY
+  void latencyStart();
+  void latencyEnd( int event );
+#endif
+#ifdef SETTINGS_TRACE
+  void traceRecord( char op, int x, int y, int w, int h, int color, const char *text, int length );
+  void traceSnapshot();
+  bool replayOp( char op );
+  void replayField( int n, long value, long *fields );
+  bool replayState( const long *fields, int nFields );
+#endif
+#ifdef SETTINGS_SCREEN
+  void screenFill( int x, int y, int w, int h );
+  void screenPrint( int x, int y, int leading, const char *text, int length, int color );
+#endif
+  bool printAt( int x, int y, const char *text, bool clean, int colorFG, int colorBG, int leading, int width = TFT_CHARS );
+  bool displayName( int i, int row, bool clean, int colorFG, int colorBG );
+  bool displayValue( int i, int row, bool clean, int colorFG, int colorBG );
+  bool highlightValue();
+  bool displaySetting( int i, int row, bool clean, int colorFG, int colorBG );
+  bool displaySettings( int first );
+  bool selectSetting( bool on );
+  bool scrollValue( int d );
+  bool scrollSetting( int d );
+  bool resetNewValue();
+  bool redisplayValue( int i );
+  bool endBatch( bool accept );
+  bool endQuickEdit();
+  bool changeValue( int i, int newIndex, bool call );
+};
+
+extern SettingsMenu settingsMenu;
+
+/**
+ * settingsHash
+ * 
+ * Return:
+ * A hash of 'text', e.g. to address a setting by its name in a stable way.
+ * The hash of NULL is 0.
+ */
+unsigned long settingsHash( const char *text );
+
+/**
+ * settingsCrc
+ * 
+ * Updates a CRC-8 (polynomial 0x07) with one byte. Start with crc = 0.
+ */
+unsigned char settingsCrc( unsigned char crc, unsigned char data );
+
 /**
  * Call to initialise the settings library.
  * 
@@ -49,8 +597,13 @@ typedef bool (*ChangeSettingFDef) (Setting *setting);
  * n:         max number of settings which can be used.
  * tft:       The display which can be used. The display should already 
  *            be initialised.
+ * nValues:   The number of values of all settings together. The menu keeps
+ *            a hashed index of this size to find values by their text (see
+ *            SettingsMenu::findValue()). 0 makes room for INDEX_VALUES values 
+ *            per setting. The values of settings which do not fit anymore are 
+ *            found by comparing them one by one.
  */
-bool initSettings( int n, ST7735_t3 *tft );
+bool initSettings( int n, ST7735_t3 *tft, int nValues = 0 );
 
 /**
  * createSetting
@@ -79,6 +632,371 @@ bool initSettings( int n, ST7735_t3 *tft );
  */
 Setting *createSetting( char *text, char **values, int nValues, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr );
 
+/**
+ * createProvidedSetting
+ * 
+ * Will create a setting of which the values are given by the functions in 
+ * 'provider', e.g. for memory channels or files on an SD card, instead of an
+ * array of texts. The text of a value is only asked for when it is needed;
+ * the menu keeps the last PROVIDER_CACHE values around the value being shown.
+ * Looking up a provided value by its text (e.g. by SettingsStore) asks for
+ * all values, one by one.
+ * 
+ * Parameters:
+ * text:      The name of the setting
+ * provider:  The functions which give the values
+ * Others:    As for createSetting()
+ * 
+ * Return:
+ * The created Setting, or NULL if it could not be created.
+ */
+Setting *createProvidedSetting( char *text, const ValueProvider *provider, int currentValue, bool liveUpdate, ChangeSettingFDef setFPtr );
+
+/**
+ * settingsValuesChanged
+ * 
+ * Call when the values of a provided setting have changed, e.g. when another
+ * SD card has been inserted. The number of values is asked for again, and
+ * the values which have been kept are forgotten. The current value is not
+ * applied again; it is limited to the new number of values. When that changes
+ * it, the listeners are told with CHANGE_LIMIT and the settings depending on
+ * it are refreshed, but its ChangeSettingFDef is not called.
+ * 
+ * Parameters:
+ * setting:   The setting
+ */
+bool settingsValuesChanged( Setting *setting );
+
+/**
+ * createTelemetry
+ * 
+ * Will create a read-only setting, of which the value is given by a function,
+ * e.g. for the S-meter or the temperature. The value is shown in the menu,
+ * but cannot be edited. It is updated by settingsPollTelemetry().
+ * 
+ * Parameters:
+ * text:    The name of the setting
+ * getFPtr: The function which gives the value as text
+ * 
+ * Return:
+ * The created Setting, or NULL if it could not be created.
+ */
+Setting *createTelemetry( char *text, TelemetryFDef getFPtr );
+
+/**
+ * settingsTelemetryInterval
+ * 
+ * Sets the time between updates of the read-only settings. The default
+ * is TELEMETRY_INTERVAL.
+ * 
+ * Parameters:
+ * interval:  The time in milliseconds
+ */
+bool settingsTelemetryInterval( unsigned long interval );
+
+/**
+ * settingsPollTelemetry
+ * 
+ * Updates the values of the read-only settings when the interval has passed
+ * since the last update. Only the values which are on the display and have
+ * changed are redrawn. Call it from loop().
+ */
+bool settingsPollTelemetry();
+
+/**
+ * setCanApply
+ * 
+ * Sets the function which checks if a value is acceptable for a setting.
+ * Values which are not acceptable are skipped when scrolling through the
+ * values, so the ChangeSettingFDef will never be called for them.
+ * 
+ * Parameters:
+ * setting:   The setting
+ * canFPtr:   The check function, or NULL to allow all values.
+ */
+bool setCanApply( Setting *setting, CanApplySettingFDef canFPtr );
+
+/**
+ * setRefresh
+ * 
+ * Sets the function which will be called when the value of a setting
+ * on which 'setting' depends has been changed.
+ * 
+ * Parameters:
+ * setting:     The setting
+ * refreshFPtr: The refresh function, or NULL.
+ */
+bool setRefresh( Setting *setting, RefreshSettingFDef refreshFPtr );
+
+/**
+ * addDependency
+ * 
+ * Declares that 'setting' depends on 'dependsOn'. After the value of 
+ * 'dependsOn' has been changed, the refresh function of 'setting' will be 
+ * called, and after that the refresh functions of the settings which depend 
+ * on 'setting', and so on. Every refresh function is called once per change,
+ * and only after the refresh functions of the settings it depends on.
+ * 
+ * Parameters:
+ * setting:     The dependent setting
+ * dependsOn:   The setting it depends on
+ * 
+ * Return:
+ * false if the dependency could not be added. This could happen when there
+ * are more than MAX_DEPENDENCIES dependencies, when the dependency 
+ * would make a cycle, or when a setting is not in the menu.
+ */
+bool addDependency( Setting *setting, Setting *dependsOn );
+
+/**
+ * settingsBatchBegin
+ * 
+ * Starts editing a batch of settings. Until settingsBatchCommit() or 
+ * settingsBatchCancel() is called, values accepted with settingsOK() are 
+ * kept pending and the ChangeSettingFDef of the settings is not called, 
+ * also not for settings with liveUpdate.
+ * 
+ * Parameters:
+ * applyFPtr: The function which will be called with all the changed
+ *            settings when the batch is committed.
+ */
+bool settingsBatchBegin( ApplySettingsFDef applyFPtr );
+
+/**
+ * settingsBatchCommit
+ * 
+ * Applies all the pending values of the batch in one call to the function
+ * given in settingsBatchBegin(). If that function does not accept the values,
+ * all the settings in the batch are reset to their current values.
+ * 
+ * Return:
+ * true if the values have been accepted, false if not
+ */
+bool settingsBatchCommit();
+
+/**
+ * settingsBatchCancel
+ * 
+ * Resets all the settings in the batch to their current values.
+ */
+bool settingsBatchCancel();
+
+/**
+ * settingsApplyPreset
+ * 
+ * Applies the values of a preset. Only for the settings of which the value
+ * differs from the current value, the ChangeSettingFDef will be called. This
+ * is done in the order in which the settings have been created. Only the
+ * changed values which are on the screen will be redisplayed.
+ * 
+ * Parameters:
+ * preset:    The preset to apply
+ * 
+ * Return:
+ * true if all the values have been accepted, false if not. The settings 
+ * of which the value has not been accepted keep their current value. The
+ * setting being edited, also while the menu is off, keeps its value and
+ * makes the result false; the other settings are applied.
+ */
+bool settingsApplyPreset( const Preset *preset );
+
+/**
+ * settingsStorePreset
+ * 
+ * Stores the current values of the settings in 'values', to be used in a preset.
+ * 
+ * Parameters:
+ * values:    Array to store the values in
+ * nValues:   Size of 'values'. Settings beyond this are not stored.
+ * 
+ * Return:
+ * false if the index of a value is PRESET_KEEP or more, e.g. of a provided
+ * setting with many values. PRESET_KEEP is stored for such a setting.
+ */
+bool settingsStorePreset( unsigned char *values, int nValues );
+
+/**
+ * settingsApplyAll
+ * 
+ * Calls the ChangeSettingFDef of every setting once with its current value,
+ * e.g. after the values have been restored at startup. A setting is applied
+ * after the settings it depends on (see addDependency()), otherwise in the 
+ * order in which the settings have been created. The RefreshSettingFDef of a
+ * setting is called just before its ChangeSettingFDef. Listeners are not
+ * called, as the values do not change.
+ * 
+ * Parameters:
+ * hookFPtr:  If not NULL, called before and after all settings are applied
+ * elapsed:   If not NULL, receives the time it took in microseconds
+ * 
+ * Return:
+ * true if all the values have been accepted, false if not. The setting
+ * being edited, also while the menu is off, is skipped and makes the result
+ * false.
+ */
+bool settingsApplyAll( ApplyAllFDef hookFPtr = NULL, unsigned long *elapsed = NULL );
+
+#ifdef SETTINGS_TIMING
+/**
+ * settingsTiming
+ * 
+ * Gets the timing of the calls to the ChangeSettingFDef of a setting.
+ * 
+ * Parameters:
+ * setting:   The setting
+ * timing:    Receives the timing
+ */
+bool settingsTiming( Setting *setting, SettingTiming *timing );
+
+/**
+ * settingsTimingReset
+ * 
+ * Clears the timing of all settings.
+ */
+bool settingsTimingReset();
+
+/**
+ * settingsTimingDump
+ * 
+ * Prints the timing of all settings, one line per setting.
+ * 
+ * Parameters:
+ * out:       Where to print to, e.g. &Serial
+ */
+bool settingsTimingDump( Print *out );
+#endif
+
+#ifdef SETTINGS_STATS
+/**
+ * settingsStats
+ * 
+ * Return:
+ * The counters of the work done by the library since the start,
+ * or since the last call to settingsStatsReset().
+ */
+SettingsStats settingsStats();
+
+/**
+ * settingsStatsReset
+ * 
+ * Clears the counters.
+ */
+bool settingsStatsReset();
+#endif
+
+#ifdef SETTINGS_LATENCY
+/**
+ * settingsInputStamp
+ * 
+ * By default, the latency of an event is measured from the call to settingsUp() etc.
+ * When input events are queued (e.g. from an interrupt), call this with the
+ * time the event was queued, just before passing the event to the library.
+ * 
+ * Parameters:
+ * stamp:     micros() at the time of the input event
+ */
+bool settingsInputStamp( unsigned long stamp );
+
+/**
+ * settingsLatency
+ * 
+ * Gets the latency of an input event.
+ * 
+ * Parameters:
+ * event:     LATENCY_UP, LATENCY_DOWN, LATENCY_OK or LATENCY_STOP
+ * latency:   Receives the latency
+ */
+bool settingsLatency( int event, SettingsLatency *latency );
+
+/**
+ * settingsLatencyReset
+ * 
+ * Clears the latencies of all events.
+ */
+bool settingsLatencyReset();
+#endif
+
+#ifdef SETTINGS_TRACE
+/**
+ * settingsTraceDump
+ * 
+ * Prints the recorded trace of the menu, oldest record first, one line per record:
+ *   time op x y w h color [text]
+ * with 'time' in microseconds and 'op' one of:
+ *   U settingsUp()          D settingsDown()         O settingsOK()
+ *   S settingsStop()        N settingsDisplayOn()    F settingsDisplayOff()
+ *   R settingsDisplayResume(), replayed as settingsDisplayOn()
+ *   s fillScreen            r fillRect               p print 'text' at (x, y),
+ *                                                      preceded by 'w' spaces
+ * The first line is the state of the menu before the records which follow:
+ *   time T currentSetting topSetting editing displayed newValue value...
+ * with the current value of each setting. The menu keeps this state at the
+ * first call in each half of the ring, so the dump starts with at least half 
+ * of the ring; older records are not printed.
+ * 
+ * Parameters:
+ * out:       Where to print to, e.g. &Serial
+ */
+bool settingsTraceDump( Print *out );
+
+/**
+ * settingsTraceClear
+ * 
+ * Clears the recorded trace.
+ */
+bool settingsTraceClear();
+
+/**
+ * settingsTraceReplay
+ * 
+ * Reads a trace printed by settingsTraceDump() and calls the library functions
+ * which have been recorded in it, in the same order. The state record first 
+ * sets the values and the state of the menu as they were when the trace 
+ * started, without calling the ChangeSettingFDef's. The drawing in the trace
+ * is not replayed, it will be done again by the library. The settings must
+ * have been created in the same way as when the trace was recorded. This 
+ * allows reproducing a recorded session with another display, e.g. on a host
+ * computer. Each menu has its own trace; use SettingsMenu::traceDump() and
+ * traceReplay() for other menus than 'settingsMenu'.
+ * 
+ * Parameters:
+ * in:        The trace, read until the end of the stream
+ */
+bool settingsTraceReplay( Stream *in );
+#endif
+
+#ifdef SETTINGS_SCREEN
+/**
+ * settingsScreenDump
+ * 
+ * Prints the screen model, one line per text line of the display. The 
+ * output can be used as the expected screen for settingsScreenCompare().
+ * 
+ * Parameters:
+ * out:       Where to print to, e.g. &Serial
+ */
+bool settingsScreenDump( Print *out );
+
+/**
+ * settingsScreenCompare
+ * 
+ * Compares the screen model with the expected screen. The colors are 
+ * compared as well, e.g. a pending value which is drawn in white instead of
+ * red is a difference.
+ * 
+ * Parameters:
+ * expected:  TFT_LINES lines, in the format of settingsScreenDump(). Lines
+ *            may be shortened, the missing characters and colors are ' ';
+ *            "" is an empty line.
+ * diff:      If not NULL, the lines which differ are printed here, 
+ *            with a '^' under each differing character and color
+ * 
+ * Return:
+ * The number of characters and colors which differ
+ */
+int settingsScreenCompare( const char * const *expected, Print *diff );
+#endif
+
 /**
  * Call to indicate that the settings library can take over the display.
  */
@@ -86,8 +1004,111 @@ bool settingsDisplayOn();
 
 /**
  * Call to indicate that the settings library cannot use the display anymore.
+ * The selected setting, and the value being edited, are kept for when the
+ * display can be used again. Until the editing has ended, settingsSet(),
+ * settingsApplyPreset() and settingsApplyAll() leave that setting alone.
  */
 bool settingsDisplayOff();
+
+/**
+ * settingsDisplayResume
+ * 
+ * Like settingsDisplayOn(), but only redraws the part of the display which
+ * has been used by the application since settingsDisplayOff(), and the lines
+ * of settings which have changed in the mean time, e.g. telemetry values.
+ * When the window or the selected setting has been changed, the whole menu is
+ * redrawn.
+ * 
+ * Parameters:
+ * x, y:      The top left corner of the part used by the application, in pixels
+ * w, h:      The width and height of that part, in pixels
+ */
+bool settingsDisplayResume( int x, int y, int w, int h );
+
+/**
+ * settingsWindow
+ * 
+ * Sets the part of the display used by the menu, e.g. the bottom 6 lines.
+ * The menu does not draw outside of it; names and values which do not fit are
+ * cut off. Call this while the display is off. By default, the menu uses the
+ * whole display.
+ * 
+ * Parameters:
+ * x, y:      The column and line of the top left corner, in characters
+ * w, h:      The number of columns and lines. At least 10 columns are needed.
+ * 
+ * Return:
+ * false if the part does not fit on the display, or the display is on
+ */
+bool settingsWindow( int x, int y, int w, int h );
+
+/**
+ * settingsSet
+ * 
+ * Changes the value of a setting from the application, e.g. on a command
+ * from a computer. The value is applied as with settingsOK(), and is only
+ * redrawn when the setting is on the display. Not possible for the setting
+ * which is being edited, nor during a batch.
+ * 
+ * Parameters:
+ * setting:   The setting
+ * index:     Index into 'values' of the new value
+ * notify:    If true, the ChangeSettingFDef is called. If false, the value 
+ *            has already been applied by the application and is only taken
+ *            over; it is then always accepted.
+ * 
+ * Return:
+ * true if the value has been accepted, false if not
+ */
+bool settingsSet( Setting *setting, int index, bool notify = true );
+
+/**
+ * settingsQuickEdit
+ * 
+ * Edits the value of a single setting on one line of the display, without
+ * showing the menu, e.g. to quickly change the volume. The value is shown in
+ * edit mode; settingsUp() and settingsDown() change it, settingsOK() applies
+ * it and settingsStop() leaves it unchanged, as in the menu. Both end the
+ * editing, after which 'repaintFPtr' is called with the line to repaint.
+ * Only possible while the menu is not displayed.
+ * 
+ * Parameters:
+ * setting:     The setting to edit
+ * line:        The line of the display to use, 0 .. TFT_LINES - 1
+ * repaintFPtr: If not NULL, called with the part of the display to repaint
+ * 
+ * Return:
+ * false if the setting cannot be edited now
+ */
+bool settingsQuickEdit( Setting *setting, int line, RepaintFDef repaintFPtr );
+
+/**
+ * settingsGetUiState
+ * 
+ * Gets the selected setting, the first setting on the display and the value
+ * being edited, e.g. to store them and continue after a reboot with
+ * settingsSetUiState().
+ * 
+ * Parameters:
+ * state:     Receives the state
+ */
+bool settingsGetUiState( SettingsUiState *state );
+
+/**
+ * settingsSetUiState
+ * 
+ * Sets the state of the menu, as given by settingsGetUiState(). Call this
+ * while the display is off, it will be shown by settingsDisplayOn(). For a
+ * setting with liveUpdate, editing continues from its current value, as the
+ * value being edited has not been applied.
+ * 
+ * Parameters:
+ * state:     The state
+ * 
+ * Return:
+ * false if the state does not fit the settings, the state is not changed then
+ */
+bool settingsSetUiState( const SettingsUiState *state );
  
 /**
  * To indicate that 'up' has been given.
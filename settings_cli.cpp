@@ -0,0 +1,207 @@
+/*
+ * A command line interface to the settings over a text stream (e.g. Serial).
+ * See settings_cli.h for the commands.
+ */
+
+
+
+#include "settings_cli.h"
+
+
+static const char *cliCommands[] = { "list", "get ", "set ", "values ", "dump" };
+#define N_COMMANDS 5
+
+
+
+/**
+ * Create a command line interface. It must be initialised with init() before use.
+ */
+SettingsCli::SettingsCli() {
+  stream = NULL;
+  menu = NULL;
+  length = 0;
+}
+
+
+/**
+ * Call to initialise the command line interface.
+ *
+ * Parameters:
+ * stream:    The stream to read commands from and to print to.
+ * menu:      The menu with the settings.
+ */
+bool SettingsCli::init( Stream *stream, SettingsMenu *menu ) {
+  this->stream = stream;
+  this->menu = menu;
+  length = 0;
+  return stream != NULL && menu != NULL;
+}
+
+
+/**
+ * Handles the characters which have been received.
+ */
+bool SettingsCli::poll() {
+  bool result = true;
+  if( stream == NULL )
+    return false;
+  while( stream->available() > 0 ) {
+    char c = stream->read();
+    if( c == '\r' || c == '\n' ) {
+      if( length == 0 )
+        continue;
+      stream->println();
+      line[length] = '\0';
+      result = execute() && result;
+      length = 0;
+    }
+    else if( c == '\b' || c == 0x7F ) {
+      if( length > 0 ) {
+        length--;
+        stream->print( "\b \b" );
+      }
+    }
+    else if( c == '\t' )
+      result = complete() && result;
+    else if( length < CLI_BUFFER - 1 && c >= ' ' ) {
+      line[length++] = c;
+      stream->print( c );
+    }
+  }
+  return result;
+}
+
+
+/**
+ * Prints setting 'i' as <name><separator><value>.
+ */
+bool SettingsCli::printSetting( int i, char separator ) {
+  Setting *setting = menu->setting( i );
+  stream->print( setting->name );
+  stream->print( separator );
+  stream->println( menu->valueText( i, setting->currentValue ) );
+  return true;
+}
+
+
+/**
+ * Finds the setting of which the name is at the start of 'args'. If 'rest'
+ * is NULL, the name must be all of 'args'. Otherwise the name must be
+ * followed by a space and the value, and '*rest' will point to the value.
+ *
+ * Return:
+ * The index of the setting, or -1 if there is no such setting.
+ */
+int SettingsCli::findSetting( char *args, char **rest ) {
+  if( rest == NULL )
+    return menu->find( args );
+
+  // Names can have spaces, so try each space as the end of the name.
+  // Prefer the split where the value is a known value of the setting.
+  int found = -1;
+  for( char *space = strchr( args, ' ' ); space != NULL; space = strchr( space + 1, ' ' ) ) {
+    *space = '\0';
+    int i = menu->find( args );
+    *space = ' ';
+    if( i < 0 )
+      continue;
+    found = i;
+    *rest = space + 1;
+    if( menu->findValue( i, space + 1 ) >= 0 )
+      break;
+  }
+  return found;
+}
+
+
+/**
+ * Executes the command in 'line'.
+ */
+bool SettingsCli::execute() {
+  bool result = true;
+  char *args = strchr( line, ' ' );
+  if( args != NULL )
+    *args++ = '\0';
+
+  if( strcmp( line, "list" ) == 0 ) {
+    for( int i=0; i<menu->count(); i++ ) {
+      if( menu->setting( i )->name == NULL )
+        continue;
+      stream->print( i );
+      stream->print( ' ' );
+      printSetting( i, '\t' );
+    }
+  }
+  else if( strcmp( line, "dump" ) == 0 ) {
+    for( int i=0; i<menu->count(); i++ )
+      if( menu->setting( i )->name != NULL )
+        printSetting( i, '=' );
+  }
+  else if( args == NULL )
+    stream->println( "usage: list | get <setting> | set <setting> <value> | values <setting> | dump" );
+  else if( strcmp( line, "get" ) == 0 || strcmp( line, "values" ) == 0 ) {
+    int i = findSetting( args, NULL );
+    if( i < 0 )
+      stream->println( "unknown setting" );
+    else if( line[0] == 'g' )
+      printSetting( i, '=' );
+    else {
+      Setting *setting = menu->setting( i );
+      for( int v=0; v<setting->nValues; v++ )
+        stream->println( menu->valueText( i, v ) );
+    }
+  }
+  else if( strcmp( line, "set" ) == 0 ) {
+    char *value = NULL;
+    int i = findSetting( args, &value );
+    int v = i >= 0 ? menu->findValue( i, value ) : -1;
+    if( i < 0 )
+      stream->println( "unknown setting" );
+    else if( v < 0 )
+      stream->println( "unknown value" );
+    else if( menu->setValue( i, v ) )
+      printSetting( i, '=' );
+    else {
+      result = false;
+      stream->println( "not accepted" );
+    }
+  }
+  else
+    stream->println( "unknown command" );
+  stream->print( "> " );
+  return result;
+}
+
+
+/**
+ * Completes the command, or the name of the setting after the command,
+ * as far as it is the same for all matches.
+ */
+bool SettingsCli::complete() {
+  line[length] = '\0';
+  char *args = strchr( line, ' ' );
+  const char *match = NULL;   // first match
+  int common = 0;             // length of the part which all matches have in common
+  char *prefix = args != NULL ? args + 1 : line;
+  int n = strlen( prefix );
+
+  for( int i=0; i<(args != NULL ? menu->count() : N_COMMANDS); i++ ) {
+    const char *candidate = args != NULL ? menu->setting( i )->name : cliCommands[i];
+    if( candidate == NULL || strncmp( candidate, prefix, n ) != 0 )
+      continue;
+    if( match == NULL ) {
+      match = candidate;
+      common = strlen( candidate );
+    }
+    else
+      while( common > n && strncmp( candidate, match, common ) != 0 )
+        common--;
+  }
+
+  // add the common part to the line
+  for( int c=n; match != NULL && c<common && length<CLI_BUFFER - 1; c++ ) {
+    line[length++] = match[c];
+    stream->print( match[c] );
+  }
+  return true;
+}
@@ -0,0 +1,59 @@
+/*
+ * A command line interface to the settings over a text stream (e.g. Serial),
+ * for debugging in the field. Commands are read one character at a time, so
+ * it never waits for input.
+ *
+ * Commands:
+ * list                       list the settings and their current values
+ * get <setting>              show the current value of a setting
+ * set <setting> <value>      change the value of a setting, as with settingsOK()
+ * values <setting>           list the allowed values of a setting
+ * dump                       show all current values as <setting>=<value>
+ *
+ * <setting> is the name given to createSetting(), e.g. "set Carrier FTaps 150".
+ * The Tab key completes the command or the name of a setting.
+ */
+
+
+#ifndef _settings_cli_h_
+#define _settings_cli_h_
+
+#include "settings.h"
+
+// The maximum length of a command line
+#ifndef CLI_BUFFER
+#define CLI_BUFFER 64
+#endif
+
+class SettingsCli {
+public:
+  SettingsCli();
+
+  /**
+   * Call to initialise the command line interface.
+   *
+   * Parameters:
+   * stream:    The stream to read commands from and to print to.
+   * menu:      The menu with the settings.
+   */
+  bool init( Stream *stream, SettingsMenu *menu = &settingsMenu );
+
+  /**
+   * Handles the characters which have been received. Does not wait for
+   * more input, so it can be called from loop().
+   */
+  bool poll();
+
+private:
+  Stream *stream;
+  SettingsMenu *menu;
+  char line[CLI_BUFFER];  // the command line read so far
+  int length;             // number of characters in 'line'
+
+  bool execute();
+  bool complete();
+  int findSetting( char *args, char **rest );
+  bool printSetting( int i, char separator );
+};
+
+#endif
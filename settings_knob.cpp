@@ -0,0 +1,117 @@
+/*
+ * A rotary encoder bound to one setting. See settings_knob.h.
+ */
+
+
+
+#include "settings_knob.h"
+
+
+
+/**
+ * Create a knob. It must be bound to a setting with init() before use.
+ */
+SettingsKnob::SettingsKnob() {
+  menu = NULL;
+  index = -1;
+  detents = 0;
+  target = 0;
+  pending = false;
+  lastTurn = 0;
+  line = -1;
+  shown = false;
+}
+
+
+/**
+ * Call to bind the knob to a setting.
+ *
+ * Parameters:
+ * setting:   The setting to change
+ * menu:      The menu with the setting
+ */
+bool SettingsKnob::init( Setting *setting, SettingsMenu *menu ) {
+  this->menu = menu;
+  index = -1;
+  if( menu == NULL )
+    return false;
+  index = menu->index( setting );
+  if( index < 0 || setting->name == NULL || setting->getFPtr != NULL )
+    return false;
+  target = setting->currentValue;
+  pending = false;
+  detents = 0;
+  return true;
+}
+
+
+/**
+ * Shows the setting on line 'line' of the display, -1 for none.
+ */
+bool SettingsKnob::setIndicator( int line ) {
+  if( line < -1 || line >= TFT_LINES )
+    return false;
+  this->line = line;
+  shown = false;
+  return true;
+}
+
+
+/**
+ * The knob has been turned 'detents' detents. Can be called from an interrupt.
+ */
+void SettingsKnob::turn( int detents ) {
+  this->detents += detents;
+}
+
+
+/**
+ * Applies the detents which have been turned.
+ */
+bool SettingsKnob::poll() {
+  bool result = true;
+  if( index < 0 )
+    return false;
+  noInterrupts();
+  int d = detents;
+  detents = 0;
+  interrupts();
+
+  Setting *setting = menu->setting( index );
+  // without a turn to apply, the knob follows changes made by others
+  if( d == 0 && !pending ) {
+    bool changed = target != setting->currentValue;
+    target = setting->currentValue;
+    if( changed && shown && line >= 0 && !menu->displayed() )
+      result = menu->indicate( index, target, line, false );
+    return result;
+  }
+  bool turned = d != 0;
+  if( turned ) {
+    if( !pending )
+      target = setting->currentValue;
+    pending = true;
+    lastTurn = millis();
+    for( ; d > 0; d-- )
+      target = menu->nextValue( index, target, 1 );
+    for( ; d < 0; d++ )
+      target = menu->nextValue( index, target, -1 );
+  }
+
+  // apply now, or when the knob has settled
+  bool settled = setting->liveUpdate || millis() - lastTurn >= KNOB_SETTLE;
+  bool apply = pending && settled && target != setting->currentValue;
+  if( apply && !menu->setValue( index, target ) ) {
+    result = false;
+    target = setting->currentValue;
+  }
+  if( settled )
+    pending = false;
+  if( line >= 0 && !menu->displayed() && (turned || apply || !shown) ) {
+    menu->indicate( index, target, line, !shown );
+    shown = true;
+  }
+  else if( menu->displayed() )
+    shown = false;
+  return result;
+}
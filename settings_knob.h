@@ -0,0 +1,67 @@
+/*
+ * A rotary encoder bound to one setting, e.g. a volume knob, which changes
+ * the value without the menu. The encoder counts the detents in an interrupt
+ * with turn(); poll() applies them as setValue() does, so values which cannot
+ * be applied are skipped and the value stops at the first and last value.
+ *
+ * A setting with liveUpdate follows the knob. Any other setting is applied
+ * when the knob has not been turned for KNOB_SETTLE milliseconds. While the
+ * menu is not displayed, the setting can be shown on a line of the display,
+ * of which only the value is redrawn while turning.
+ */
+
+
+#ifndef _settings_knob_h_
+#define _settings_knob_h_
+
+#include "settings.h"
+
+// Time in milliseconds without turning after which the value of a setting
+// without liveUpdate is applied
+#ifndef KNOB_SETTLE
+#define KNOB_SETTLE 300
+#endif
+
+class SettingsKnob {
+public:
+  SettingsKnob();
+
+  /**
+   * Call to bind the knob to a setting.
+   *
+   * Parameters:
+   * setting:   The setting to change
+   * menu:      The menu with the setting
+   */
+  bool init( Setting *setting, SettingsMenu *menu = &settingsMenu );
+
+  /**
+   * Shows the setting on line 'line' of the display while the knob is
+   * turned and the menu is not displayed. -1 shows nothing, this is the default.
+   */
+  bool setIndicator( int line );
+
+  /**
+   * To indicate that the knob has been turned 'detents' detents, negative
+   * for down. Can be called from an interrupt.
+   */
+  void turn( int detents );
+
+  /**
+   * Applies the detents which have been turned. Call it from loop(). A value
+   * set by others, e.g. with settingsSet(), is kept until the knob is turned.
+   */
+  bool poll();
+
+private:
+  SettingsMenu *menu;
+  int index;                  // index of the setting in 'menu'
+  volatile int detents;       // detents turned since the last poll()
+  int target;                 // value selected with the knob
+  bool pending;               // 'target' has been turned to, but not applied yet
+  unsigned long lastTurn;     // millis() of the last detent
+  int line;                   // line of the indicator, -1 if none
+  bool shown;                 // the indicator is on the display
+};
+
+#endif
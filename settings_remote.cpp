@@ -0,0 +1,356 @@
+/*
+ * Remote control of the settings over a byte stream (e.g. Serial), with a
+ * compact binary protocol. See settings_remote.h for the protocol.
+ */
+
+
+
+#include "settings_remote.h"
+
+
+// States of the receiver
+#define STATE_START 0   // waiting for REMOTE_START
+#define STATE_LENGTH 1  // waiting for the length
+#define STATE_BODY 2    // receiving command, sequence and arguments
+#define STATE_CRC 3     // waiting for the crc
+
+
+
+/**
+ * Puts 'value' in 'bytes' as 2 bytes, least significant byte first.
+ *
+ * Return:
+ * false if 'value' does not fit, REMOTE_NONE is put in 'bytes' then
+ */
+static bool putShort( unsigned char *bytes, long value ) {
+  bool fits = value >= 0 && value < REMOTE_NONE;
+  if( !fits )
+    value = REMOTE_NONE;
+  bytes[0] = value;
+  bytes[1] = value >> 8;
+  return fits;
+}
+
+
+/**
+ * Return:
+ * The 2 bytes in 'bytes', least significant byte first.
+ */
+static int getShort( const unsigned char *bytes ) {
+  return bytes[0] | (bytes[1] << 8);
+}
+
+
+/**
+ * Create a remote control. It must be initialised with init() before use.
+ */
+SettingsRemote::SettingsRemote() {
+  stream = NULL;
+  menu = NULL;
+  state = STATE_START;
+  length = 0;
+  watch = false;
+  firstChange = 0;
+  nChanges = 0;
+  changeSequence = 0;
+  lost = 0;
+}
+
+
+/**
+ * Call to initialise the remote control.
+ *
+ * Parameters:
+ * stream:    The stream to receive commands from and to send replies to.
+ * menu:      The menu with the settings.
+ */
+bool SettingsRemote::init( Stream *stream, SettingsMenu *menu ) {
+  this->stream = stream;
+  this->menu = menu;
+  state = STATE_START;
+  if( stream == NULL || menu == NULL )
+    return false;
+  return menu->addListener( listener, this );
+}
+
+
+/**
+ * Handles the commands which have been received.
+ */
+bool SettingsRemote::poll() {
+  bool result = true;
+  if( stream == NULL )
+    return false;
+  while( stream->available() > 0 ) {
+    unsigned char c = stream->read();
+    switch( state ) {
+      case STATE_START:
+        if( c == REMOTE_START )
+          state = STATE_LENGTH;
+        break;
+      case STATE_LENGTH:
+        // command and sequence are needed, and must fit in 'buffer'
+        if( c < 2 || c >= REMOTE_BUFFER ) {
+          state = STATE_START;
+          break;
+        }
+        buffer[0] = c;
+        length = 1;
+        state = STATE_BODY;
+        break;
+      case STATE_BODY:
+        buffer[length++] = c;
+        if( length == buffer[0] + 1 )
+          state = STATE_CRC;
+        break;
+      case STATE_CRC: {
+        unsigned char crc = 0;
+        for( int i=0; i<length; i++ )
+          crc = settingsCrc( crc, buffer[i] );
+        // a frame with a wrong crc is ignored, the remote will time out
+        if( crc == c )
+          result = handleFrame() && result;
+        state = STATE_START;
+        break;
+      }
+    }
+  }
+  result = sendChanges() && result;
+  return result;
+}
+
+
+/**
+ * Called by the menu on every change of a value. Queues the change
+ * to be sent in poll().
+ */
+void SettingsRemote::listener( void *context, const SettingsChange *change ) {
+  SettingsRemote *remote = (SettingsRemote *) context;
+  if( !remote->watch )
+    return;
+  if( remote->nChanges == REMOTE_CHANGES ) {
+    // drop the oldest change
+    remote->firstChange = (remote->firstChange + 1) % REMOTE_CHANGES;
+    remote->nChanges--;
+    if( remote->lost < 255 )
+      remote->lost++;
+  }
+  RemoteChange *record = &remote->changes[(remote->firstChange + remote->nChanges) % REMOTE_CHANGES];
+  record->index = change->index;
+  record->oldValue = change->oldValue;
+  record->newValue = change->newValue;
+  record->accepted = change->accepted;
+  record->kind = change->kind;
+  record->millis = change->millis;
+  remote->nChanges++;
+}
+
+
+/**
+ * Sends the queued changes, as far as the stream can take them.
+ */
+bool SettingsRemote::sendChanges() {
+  bool result = true;
+  unsigned char results[12];
+  // frame: start, length, command, sequence, status, results, crc
+  while( nChanges > 0 && stream->availableForWrite() >= 5 + (int) sizeof( results ) + 1 ) {
+    RemoteChange *record = &changes[firstChange];
+    // a value which does not fit is sent as REMOTE_NONE
+    putShort( &results[0], record->index );
+    putShort( &results[2], record->oldValue );
+    putShort( &results[4], record->newValue );
+    results[6] = record->accepted;
+    results[7] = record->kind;
+    for( int b=0; b<4; b++ )
+      results[8 + b] = record->millis >> (8 * b);
+    result = result && send( REMOTE_CHANGE, changeSequence++, lost, results, sizeof( results ), NULL );
+    lost = 0;
+    firstChange = (firstChange + 1) % REMOTE_CHANGES;
+    nChanges--;
+  }
+  return result;
+}
+
+
+/**
+ * Reads the address of a setting from the arguments in 'buffer', at '*pos'.
+ * '*pos' is moved past the address.
+ *
+ * Return:
+ * The index of the setting, or -1 if there is no such setting.
+ */
+int SettingsRemote::address( int *pos ) {
+  int end = buffer[0] + 1;
+  if( *pos + 2 > end ) {
+    *pos = end;
+    return -1;
+  }
+  int first = getShort( &buffer[*pos] );
+  *pos += 2;
+  if( first != REMOTE_HASH ) {
+    Setting *setting = menu->setting( first );
+    return (setting != NULL && setting->name != NULL) ? first : -1;
+  }
+  if( *pos + 4 > end )
+    return -1;
+  unsigned long hash = 0;
+  for( int i=3; i>=0; i-- )
+    hash = (hash << 8) | buffer[*pos + i];
+  *pos += 4;
+  return menu->find( hash );
+}
+
+
+/**
+ * Sends a frame.
+ *
+ * Parameters:
+ * command:   The command
+ * sequence:  The sequence
+ * status:    REMOTE_OK etc.
+ * results:   'nResults' bytes to send after the status
+ * text:      If not NULL, text to send after the results
+ */
+bool SettingsRemote::send( unsigned char command, unsigned char sequence, unsigned char status,
+                           const unsigned char *results, int nResults, const char *text ) {
+  int nText = text != NULL ? strlen( text ) : 0;
+  if( 3 + nResults + nText > 255 )
+    nText = 255 - 3 - nResults;
+  unsigned char header[5] = { REMOTE_START, (unsigned char)(3 + nResults + nText),
+                              command, sequence, status };
+  unsigned char crc = 0;
+  for( int i=1; i<5; i++ )
+    crc = settingsCrc( crc, header[i] );
+  for( int i=0; i<nResults; i++ )
+    crc = settingsCrc( crc, results[i] );
+  for( int i=0; i<nText; i++ )
+    crc = settingsCrc( crc, text[i] );
+  stream->write( header, 5 );
+  if( nResults > 0 )
+    stream->write( results, nResults );
+  if( nText > 0 )
+    stream->write( (const unsigned char *) text, nText );
+  stream->write( crc );
+  return true;
+}
+
+
+/**
+ * Sends a reply to a command, see send().
+ */
+bool SettingsRemote::reply( unsigned char command, unsigned char sequence, unsigned char status,
+                            const unsigned char *results, int nResults, const char *text ) {
+  return send( command | REMOTE_REPLY, sequence, status, results, nResults, text );
+}
+
+
+/**
+ * Handles the command in 'buffer'.
+ */
+bool SettingsRemote::handleFrame() {
+  bool result = true;
+  unsigned char command = buffer[1];
+  unsigned char sequence = buffer[2];
+  int end = buffer[0] + 1;
+  int pos = 3;
+  unsigned char results[REMOTE_BUFFER];
+
+  switch( command ) {
+
+    case REMOTE_LIST:
+      for( int i=0; i<menu->count() && i<REMOTE_HASH; i++ ) {
+        Setting *setting = menu->setting( i );
+        if( setting->name == NULL )
+          continue;
+        unsigned long hash = settingsHash( setting->name );
+        putShort( results, i );
+        for( int b=0; b<4; b++ )
+          results[2 + b] = hash >> (8 * b);
+        // nValues may be REMOTE_NONE, as it is not a value
+        bool fits = setting->nValues <= REMOTE_NONE;
+        results[6] = fits ? setting->nValues : REMOTE_NONE & 0xFF;
+        results[7] = fits ? setting->nValues >> 8 : REMOTE_NONE >> 8;
+        fits = putShort( &results[8], setting->currentValue ) && fits;
+        result = result && reply( command, sequence, fits ? REMOTE_OK : REMOTE_BAD, results, 10, setting->name );
+      }
+      result = result && reply( command, sequence, REMOTE_END, NULL, 0, NULL );
+      break;
+
+    case REMOTE_GET: {
+      int i = address( &pos );
+      if( i < 0 )
+        return reply( command, sequence, REMOTE_UNKNOWN, NULL, 0, NULL );
+      Setting *setting = menu->setting( i );
+      putShort( results, i );
+      if( !putShort( &results[2], setting->currentValue ) )
+        return reply( command, sequence, REMOTE_BAD, results, 4, NULL );
+      result = result && reply( command, sequence, REMOTE_OK, results, 4, menu->valueText( i, setting->currentValue ) );
+      break;
+    }
+
+    case REMOTE_SET: {
+      int i = address( &pos );
+      if( i < 0 || pos + 2 > end )
+        return reply( command, sequence, i < 0 ? REMOTE_UNKNOWN : REMOTE_BAD, NULL, 0, NULL );
+      Setting *setting = menu->setting( i );
+      int value = getShort( &buffer[pos] );
+      unsigned char status = REMOTE_OK;
+      if( value == REMOTE_NONE || value >= setting->nValues )
+        status = REMOTE_UNKNOWN;
+      else if( !menu->setValue( i, value ) )
+        status = REMOTE_REJECTED;
+      putShort( results, i );
+      putShort( &results[2], setting->currentValue );
+      result = result && reply( command, sequence, status, results, 4, NULL );
+      break;
+    }
+
+    case REMOTE_DUMP: {
+      // as many replies as needed, each with the values from 'first' on
+      int n = menu->count();
+      for( int first=0; first<n; first+=REMOTE_DUMP_VALUES ) {
+        int nValues = 0;
+        putShort( results, first );
+        for( int i=first; i<n && nValues<REMOTE_DUMP_VALUES; i++, nValues++ ) {
+          Setting *setting = menu->setting( i );
+          putShort( &results[2 + 2 * nValues], setting->name != NULL ? setting->currentValue : REMOTE_NONE );
+        }
+        result = result && reply( command, sequence, REMOTE_OK, results, 2 + 2 * nValues, NULL );
+      }
+      putShort( results, n );
+      result = result && reply( command, sequence, REMOTE_END, results, 2, NULL );
+      break;
+    }
+
+    case REMOTE_SETS: {
+      // apply each (setting, value), also when one of them fails
+      int n = 0;
+      while( pos < end ) {
+        int i = address( &pos );
+        if( pos + 2 > end )
+          return reply( command, sequence, REMOTE_BAD, results, n, NULL );
+        int value = getShort( &buffer[pos] );
+        pos += 2;
+        if( i < 0 || value == REMOTE_NONE || value >= menu->setting( i )->nValues )
+          results[n++] = REMOTE_UNKNOWN;
+        else
+          results[n++] = menu->setValue( i, value ) ? REMOTE_OK : REMOTE_REJECTED;
+      }
+      result = result && reply( command, sequence, REMOTE_OK, results, n, NULL );
+      break;
+    }
+
+    case REMOTE_WATCH:
+      if( pos >= end )
+        return reply( command, sequence, REMOTE_BAD, NULL, 0, NULL );
+      watch = buffer[pos] != 0;
+      if( !watch )
+        nChanges = 0;
+      result = result && reply( command, sequence, REMOTE_OK, NULL, 0, NULL );
+      break;
+
+    default:
+      result = result && reply( command, sequence, REMOTE_BAD, NULL, 0, NULL );
+  }
+  return result;
+}
@@ -0,0 +1,141 @@
+/*
+ * Remote control of the settings over a byte stream (e.g. Serial), with a
+ * compact binary protocol. A remote computer can list the settings, get and
+ * set their values, and get all the values at once.
+ *
+ * Frame:    0xA5, length, command, sequence, arguments..., crc
+ *           'length' is the number of bytes from 'command' up to and including
+ *           the arguments. 'crc' is a CRC-8 (settingsCrc()) over 'length' up to
+ *           and including the arguments. 'sequence' is chosen by the remote.
+ * Reply:    0xA5, length, command | 0x80, sequence, status, results..., crc
+ *
+ * Indices of settings and of values take 2 bytes, least significant byte
+ * first. A setting is addressed with its index, or with 0xFFFF followed by
+ * the 4 byte settingsHash() of its name, least significant byte first.
+ * 0xFFFF is not a value; it is sent for an empty line, and for a value which
+ * does not fit in 2 bytes.
+ *
+ * Command         Arguments              Results
+ * LIST    0x01    -                      one reply per setting: index[2], hash[4], 
+ *                                        nValues[2], currentValue[2], name, and a
+ *                                        last reply with status REMOTE_END
+ * GET     0x02    setting                index[2], currentValue[2], value text
+ * SET     0x03    setting, value[2]      index[2], currentValue[2]
+ * DUMP    0x04    -                      replies with first[2] and currentValue[2] 
+ *                                        of up to REMOTE_DUMP_VALUES settings from
+ *                                        index 'first' on, and a last reply with 
+ *                                        status REMOTE_END and nSettings[2]
+ * SETS    0x05    (setting, value[2])... status of each (setting, value)
+ * WATCH   0x06    on                     -
+ * A reply to LIST or GET with a value which does not fit has status REMOTE_BAD.
+ *
+ * After WATCH with 'on' != 0, a frame is sent for every change of a value
+ * (see SettingsMenu::addListener()), until WATCH with 'on' == 0:
+ * CHANGE  0x40    sequence: number of the change, status: number of changes lost
+ *                 before this one, results: index[2], oldValue[2], newValue[2], 
+ *                 accepted, kind (CHANGE_COMMIT etc.), millis[4]
+ * A change is sent after 'currentValue' of the setting has been updated.
+ * The changes are queued in a ring of REMOTE_CHANGES records, which is sent
+ * in poll() only as far as the stream can take it without blocking. When the 
+ * ring is full, the oldest change is lost. This needs a stream which 
+ * implements availableForWrite().
+ *
+ * Values are set in the same way as with settingsOK(), so the ChangeSettingFDef
+ * of the setting decides if a value is accepted. The remote does not have to
+ * wait for a reply before sending the next command, so a number of values can
+ * be set in one round trip, either with SETS or with a series of SET commands.
+ */
+
+
+#ifndef _settings_remote_h_
+#define _settings_remote_h_
+
+#include "settings.h"
+
+#define REMOTE_START 0xA5
+#define REMOTE_REPLY 0x80
+#define REMOTE_HASH 0xFFFF    // setting is addressed by the hash of its name
+#define REMOTE_NONE 0xFFFF    // no value
+
+// Commands
+#define REMOTE_LIST 0x01
+#define REMOTE_GET 0x02
+#define REMOTE_SET 0x03
+#define REMOTE_DUMP 0x04
+#define REMOTE_SETS 0x05
+#define REMOTE_WATCH 0x06
+#define REMOTE_CHANGE 0x40
+
+// Status in replies
+#define REMOTE_OK 0
+#define REMOTE_REJECTED 1     // the value has not been accepted
+#define REMOTE_UNKNOWN 2      // no such setting or value
+#define REMOTE_BAD 3          // unknown command or wrong arguments
+#define REMOTE_END 4          // last reply of LIST and DUMP
+
+// The maximum length of a received frame
+#ifndef REMOTE_BUFFER
+#define REMOTE_BUFFER 64
+#endif
+
+// The number of values in a reply to DUMP
+#define REMOTE_DUMP_VALUES ((REMOTE_BUFFER - 2) / 2)
+
+// The maximum number of changes waiting to be sent
+#ifndef REMOTE_CHANGES
+#define REMOTE_CHANGES 16
+#endif
+
+typedef struct RemoteChanges {
+  int index;
+  int oldValue;
+  int newValue;
+  unsigned char accepted;
+  unsigned char kind;
+  unsigned long millis;
+} RemoteChange;
+
+class SettingsRemote {
+public:
+  SettingsRemote();
+
+  /**
+   * Call to initialise the remote control.
+   *
+   * Parameters:
+   * stream:    The stream to receive commands from and to send replies to.
+   * menu:      The menu with the settings.
+   */
+  bool init( Stream *stream, SettingsMenu *menu = &settingsMenu );
+
+  /**
+   * Handles the commands which have been received, and sends the queued
+   * changes. Does not wait for more input or output, so it can be called
+   * from loop().
+   */
+  bool poll();
+
+private:
+  Stream *stream;
+  SettingsMenu *menu;
+  int state;                          // where in a frame we are
+  unsigned char buffer[REMOTE_BUFFER]; // 'length', command, sequence and arguments
+  int length;                         // number of bytes received in 'buffer'
+  bool watch;                         // send the changes
+  RemoteChange changes[REMOTE_CHANGES]; // ring of changes to send
+  int firstChange;                    // oldest change in 'changes'
+  int nChanges;                       // number of changes in 'changes'
+  unsigned char changeSequence;       // number of the next change to send
+  unsigned char lost;                 // changes lost since the last one sent
+
+  static void listener( void *context, const SettingsChange *change );
+  bool sendChanges();
+  bool handleFrame();
+  int address( int *pos );
+  bool send( unsigned char command, unsigned char sequence, unsigned char status,
+             const unsigned char *results, int nResults, const char *text );
+  bool reply( unsigned char command, unsigned char sequence, unsigned char status,
+              const unsigned char *results, int nResults, const char *text );
+};
+
+#endif
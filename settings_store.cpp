@@ -0,0 +1,573 @@
+/*
+ * Persistent storage of the current values of the settings, in EEPROM or
+ * (for tests on a host computer) in a file. See settings_store.h for the
+ * format of the journal.
+ */
+
+
+
+#include "settings_store.h"
+#ifdef ARDUINO
+#include <EEPROM.h>
+#else
+#include <stdio.h>
+#endif
+
+
+
+#ifdef ARDUINO
+SettingsEEPROM::SettingsEEPROM( int start, int n ) {
+  this->start = start;
+  this->n = n;
+}
+
+
+int SettingsEEPROM::size() {
+  return n;
+}
+
+
+bool SettingsEEPROM::read( int address, unsigned char *data, int n ) {
+  for( int i=0; i<n; i++ )
+    data[i] = EEPROM.read( start + address + i );
+  return true;
+}
+
+
+bool SettingsEEPROM::write( int address, const unsigned char *data, int n ) {
+  // only bytes which change are written
+  for( int i=0; i<n; i++ )
+    EEPROM.update( start + address + i, data[i] );
+  return true;
+}
+#else
+SettingsFileStorage::SettingsFileStorage( const char *path, int n ) {
+  this->n = n;
+  FILE *f = fopen( path, "r+b" );
+  if( f == NULL ) {
+    // a new file is erased
+    f = fopen( path, "w+b" );
+    for( int i=0; f != NULL && i<n; i++ )
+      fputc( STORE_ERASED, f );
+  }
+  file = f;
+}
+
+
+SettingsFileStorage::~SettingsFileStorage() {
+  if( file != NULL )
+    fclose( (FILE *) file );
+}
+
+
+int SettingsFileStorage::size() {
+  return file != NULL ? n : 0;
+}
+
+
+bool SettingsFileStorage::read( int address, unsigned char *data, int n ) {
+  FILE *f = (FILE *) file;
+  if( f == NULL || fseek( f, address, SEEK_SET ) != 0 )
+    return false;
+  return fread( data, 1, n, f ) == (size_t) n;
+}
+
+
+bool SettingsFileStorage::write( int address, const unsigned char *data, int n ) {
+  FILE *f = (FILE *) file;
+  if( f == NULL || fseek( f, address, SEEK_SET ) != 0 )
+    return false;
+  bool result = fwrite( data, 1, n, f ) == (size_t) n;
+  return fflush( f ) == 0 && result;
+}
+#endif
+
+static SettingsStore *defaultStore = NULL;   // for settingsFlush()
+
+
+/**
+ * Create a store. It must be initialised with init() before use.
+ */
+SettingsStore::SettingsStore() {
+  storage = NULL;
+  menu = NULL;
+  bankSize = 0;
+  bank = -1;
+  generation = 0;
+  next = 0;
+  switching = false;
+  erased = 0;
+  copied = 0;
+  switchNext = 0;
+  dirty = NULL;
+  nDirty = 0;
+  nChanged = 0;
+  nextDirty = 0;
+  lastChange = 0;
+  quiet = STORE_QUIET;
+}
+
+
+/**
+ * Call to initialise the storage of the values.
+ *
+ * Parameters:
+ * storage:   Where the values are kept.
+ * menu:      The menu with the settings.
+ */
+bool SettingsStore::init( SettingsStorage *storage, SettingsMenu *menu ) {
+  // the listener is added once to each menu
+  bool listening = this->menu == menu;
+  this->storage = storage;
+  this->menu = menu;
+  if( storage == NULL || menu == NULL )
+    return false;
+  bankSize = storage->size() / 2;
+  bank = -1;
+  switching = false;
+  nChanged = 0;
+  nextDirty = 0;
+  // a second init() reuses the flags, when there is room
+  if( dirty == NULL || nDirty < menu->count() ) {
+    free( dirty );
+    dirty = (unsigned char *) malloc( menu->count() );
+  }
+  nDirty = dirty != NULL ? menu->count() : 0;
+  if( dirty == NULL )
+    return false;
+  memset( dirty, 0, nDirty );
+  if( defaultStore == NULL )
+    defaultStore = this;
+
+  // the active bank is the valid one with the highest generation
+  unsigned long generations[2];
+  bool valid[2];
+  for( int b=0; b<2; b++ )
+    valid[b] = readHeader( b, &generations[b] );
+  if( valid[0] && (!valid[1] || generations[0] > generations[1]) )
+    bank = 0;
+  else if( valid[1] )
+    bank = 1;
+  if( bank >= 0 ) {
+    generation = generations[bank];
+    // find the end of the journal
+    unsigned long name, value;
+    next = STORE_HEADER;
+    while( next + STORE_RECORD <= bankSize && readRecord( bank * bankSize + next, &name, &value ) )
+      next += STORE_RECORD;
+  }
+  return listening || menu->addListener( listener, this );
+}
+
+
+/**
+ * Reads the header of bank 'bank'.
+ *
+ * Return:
+ * true if the header is valid
+ */
+bool SettingsStore::readHeader( int bank, unsigned long *generation ) {
+  unsigned char header[STORE_HEADER];
+  if( !storage->read( bank * bankSize, header, STORE_HEADER ) )
+    return false;
+  unsigned char crc = 0;
+  for( int i=0; i<STORE_HEADER-1; i++ )
+    crc = settingsCrc( crc, header[i] );
+  if( header[0] != 'S' || header[1] != 'J' || header[2] != STORE_VERSION || crc != header[STORE_HEADER-1] )
+    return false;
+  *generation = 0;
+  for( int i=6; i>=3; i-- )
+    *generation = (*generation << 8) | header[i];
+  return true;
+}
+
+
+/**
+ * The crc of a record, in the active generation.
+ */
+static unsigned char recordCrc( unsigned long generation, const unsigned char *record ) {
+  unsigned char crc = 0;
+  for( int i=0; i<4; i++ )
+    crc = settingsCrc( crc, generation >> (8 * i) );
+  for( int i=0; i<STORE_RECORD-1; i++ )
+    crc = settingsCrc( crc, record[i] );
+  return crc;
+}
+
+
+/**
+ * Reads the record at 'address'.
+ *
+ * Return:
+ * true if the record is valid
+ */
+bool SettingsStore::readRecord( int address, unsigned long *name, unsigned long *value ) {
+  unsigned char record[STORE_RECORD];
+  if( !storage->read( address, record, STORE_RECORD ) )
+    return false;
+  *name = 0;
+  *value = 0;
+  for( int i=3; i>=0; i-- ) {
+    *name = (*name << 8) | record[i];
+    *value = (*value << 8) | record[4 + i];
+  }
+  return record[STORE_RECORD-1] == recordCrc( generation, record );
+}
+
+
+/**
+ * Writes a record with the current value of 'setting' at 'address', in a
+ * bank of generation 'generation'.
+ */
+bool SettingsStore::writeRecord( int address, Setting *setting, unsigned long generation ) {
+  unsigned char record[STORE_RECORD];
+  unsigned long name = settingsHash( setting->name );
+  unsigned long value = settingsHash( menu->valueText( menu->index( setting ), setting->currentValue ) );
+  for( int i=0; i<4; i++ ) {
+    record[i] = name >> (8 * i);
+    record[4 + i] = value >> (8 * i);
+  }
+  record[STORE_RECORD-1] = recordCrc( generation, record );
+  return storage->write( address, record, STORE_RECORD );
+}
+
+
+/**
+ * Settings which are stored; read-only settings are not.
+ */
+static bool storedSetting( Setting *setting ) {
+  return setting->name != NULL && setting->nValues > 0 && setting->getFPtr == NULL;
+}
+
+
+/**
+ * Starts making the other bank the active bank, with the current values of
+ * all settings. switchStep() writes it.
+ *
+ * Return:
+ * false if the current values do not fit in a bank
+ */
+bool SettingsStore::startSwitch() {
+  int size = STORE_HEADER;
+  for( int i=0; i<menu->count(); i++ )
+    if( storedSetting( menu->setting( i ) ) )
+      size += STORE_RECORD;
+  if( size > bankSize )
+    return false;
+  switching = true;
+  erased = 0;
+  copied = 0;
+  switchNext = STORE_HEADER;
+  return true;
+}
+
+
+/**
+ * Writes the next part of the other bank: erases a record, copies the value
+ * of a setting or finally writes the header, which makes it the active bank.
+ * Until then the active bank stays in use, so a switch can be interrupted at
+ * any moment.
+ */
+bool SettingsStore::switchStep() {
+  int other = bank == 0 ? 1 : 0;
+  int start = other * bankSize;
+  // the active bank keeps its generation until the new header is written
+  unsigned long newGeneration = generation + 1;
+
+  // erase the bank
+  if( erased < bankSize ) {
+    unsigned char data[STORE_RECORD];
+    int n = bankSize - erased < STORE_RECORD ? bankSize - erased : STORE_RECORD;
+    memset( data, STORE_ERASED, STORE_RECORD );
+    if( !storage->write( start + erased, data, n ) )
+      return false;
+    erased += n;
+    return true;
+  }
+
+  // copy the current value of the next stored setting
+  for( ; copied<menu->count(); copied++ ) {
+    Setting *setting = menu->setting( copied );
+    if( !storedSetting( setting ) )
+      continue;
+    if( switchNext + STORE_RECORD > bankSize ||
+        !writeRecord( start + switchNext, setting, newGeneration ) )
+      return false;
+    switchNext += STORE_RECORD;
+    if( copied < nDirty && dirty[copied] ) {
+      dirty[copied] = 0;
+      nChanged--;
+    }
+    copied++;
+    return true;
+  }
+
+  // the header makes it the active bank
+  unsigned char header[STORE_HEADER] = { 'S', 'J', STORE_VERSION };
+  for( int i=0; i<4; i++ )
+    header[3 + i] = newGeneration >> (8 * i);
+  unsigned char crc = 0;
+  for( int i=0; i<STORE_HEADER-1; i++ )
+    crc = settingsCrc( crc, header[i] );
+  header[STORE_HEADER-1] = crc;
+  if( !storage->write( start, header, STORE_HEADER ) )
+    return false;
+  bank = other;
+  generation = newGeneration;
+  next = switchNext;
+  switching = false;
+  return true;
+}
+
+
+/**
+ * Sets the current values of the settings to the stored values.
+ */
+bool SettingsStore::restore() {
+  if( bank < 0 )
+    return false;
+  unsigned long name, value;
+  // the last record of a setting has its value
+  for( int a=STORE_HEADER; a<next; a+=STORE_RECORD ) {
+    readRecord( bank * bankSize + a, &name, &value );
+    int i = menu->find( name );
+    int v = i >= 0 ? menu->findValue( i, value ) : -1;
+    if( v < 0 )
+      continue;
+    Setting *setting = menu->setting( i );
+    setting->currentValue = v;
+    setting->newValue = v;
+  }
+  return true;
+}
+
+
+/**
+ * Writes the current value of setting 'i' now.
+ */
+bool SettingsStore::save( int i ) {
+  bool result = true;
+  Setting *setting = menu->setting( i );
+  if( storage == NULL || setting == NULL )
+    return false;
+  // the first value, or a full bank, starts a new bank
+  if( !switching && (bank < 0 || next + STORE_RECORD > bankSize) && !startSwitch() )
+    return false;
+  if( switching ) {
+    // a value which has not been copied yet is written with the new bank
+    if( i >= copied )
+      return true;
+    // after its copy, the value is written into the new bank
+    int start = (bank == 0 ? 1 : 0) * bankSize;
+    result = switchNext + STORE_RECORD <= bankSize &&
+             writeRecord( start + switchNext, setting, generation + 1 );
+    if( result )
+      switchNext += STORE_RECORD;
+  }
+  else {
+    result = writeRecord( bank * bankSize + next, setting, generation );
+    if( result )
+      next += STORE_RECORD;
+  }
+  // only a written value is done
+  if( result && i < nDirty && dirty[i] ) {
+    dirty[i] = 0;
+    nChanged--;
+  }
+  return result;
+}
+
+
+/**
+ * Writes the first changed value from 'nextDirty' on.
+ */
+bool SettingsStore::writeNext() {
+  if( switching )
+    return switchStep();
+  for( int n=0; n<nDirty; n++ ) {
+    int i = nextDirty;
+    nextDirty = (nextDirty + 1) % nDirty;
+    if( dirty[i] )
+      return save( i );
+  }
+  return true;
+}
+
+
+/**
+ * Writes the changed values, one record per call, when no value has been
+ * changed for 'quiet' milliseconds or when the menu is not displayed. A new
+ * bank is written in the same steps.
+ */
+bool SettingsStore::poll() {
+  if( nChanged == 0 && !switching )
+    return true;
+  if( menu->displayed() && millis() - lastChange < quiet )
+    return true;
+  return writeNext();
+}
+
+
+/**
+ * Writes all changed values now, and completes a new bank.
+ */
+bool SettingsStore::flush() {
+  bool result = true;
+  while( (nChanged > 0 || switching) && result )
+    result = writeNext();
+  return result;
+}
+
+
+/**
+ * Sets the time without changes after which poll() writes the changes.
+ */
+bool SettingsStore::setQuiet( unsigned long quiet ) {
+  this->quiet = quiet;
+  return true;
+}
+
+
+/**
+ * Called by the menu on every change of a value. Marks the value to be
+ * written when it has been accepted.
+ */
+void SettingsStore::listener( void *context, const SettingsChange *change ) {
+  SettingsStore *store = (SettingsStore *) context;
+  // a live value, or its reset, is not a new current value
+  if( (change->kind != CHANGE_COMMIT && change->kind != CHANGE_LIMIT) || !change->accepted )
+    return;
+  // a change of a menu of an earlier init()
+  if( store->menu == NULL || store->menu->setting( change->index ) != change->setting )
+    return;
+  store->lastChange = change->millis;
+  // a setting created after init() is written now
+  if( change->index >= store->nDirty ) {
+    store->save( change->index );
+    return;
+  }
+  if( !store->dirty[change->index] ) {
+    store->dirty[change->index] = 1;
+    store->nChanged++;
+  }
+}
+
+
+/**
+ * settingsFlush
+ *
+ * Writes all changed values of the first store which has been initialised.
+ */
+bool settingsFlush() {
+  if( defaultStore == NULL )
+    return false;
+  return defaultStore->flush();
+}
+
+
+/**
+ * The number of bits for a value of 'setting'.
+ */
+static int snapshotBits( Setting *setting ) {
+  int bits = 0;
+  if( setting->name == NULL )
+    return 0;
+  while( (1 << bits) < setting->nValues )
+    bits++;
+  return bits;
+}
+
+
+/**
+ * The hash of the names and numbers of values of the settings of 'menu'.
+ */
+static unsigned long snapshotSchema( SettingsMenu *menu ) {
+  unsigned long hash = 2166136261UL;
+  for( int i=0; i<menu->count(); i++ ) {
+    Setting *setting = menu->setting( i );
+    hash = (hash ^ settingsHash( setting->name )) * 16777619UL;
+    hash = (hash ^ setting->nValues) * 16777619UL;
+  }
+  return hash;
+}
+
+
+/**
+ * settingsSnapshotSize
+ *
+ * The number of bytes needed for a snapshot of 'menu'.
+ */
+int settingsSnapshotSize( SettingsMenu *menu ) {
+  int bits = 0;
+  for( int i=0; i<menu->count(); i++ )
+    bits += snapshotBits( menu->setting( i ) );
+  return SNAPSHOT_HEADER + (bits + 7) / 8 + 1;
+}
+
+
+/**
+ * settingsSnapshot
+ *
+ * Writes a snapshot of the current values of 'menu' into 'buffer'.
+ */
+int settingsSnapshot( unsigned char *buffer, int size, SettingsMenu *menu ) {
+  int n = settingsSnapshotSize( menu );
+  if( buffer == NULL || size < n )
+    return -1;
+  memset( buffer, 0, n );
+  unsigned long schema = snapshotSchema( menu );
+  for( int b=0; b<SNAPSHOT_HEADER; b++ )
+    buffer[b] = schema >> (8 * b);
+
+  int bit = SNAPSHOT_HEADER * 8;
+  for( int i=0; i<menu->count(); i++ ) {
+    Setting *setting = menu->setting( i );
+    int bits = snapshotBits( setting );
+    for( int b=0; b<bits; b++, bit++ )
+      if( setting->currentValue & (1 << b) )
+        buffer[bit / 8] |= 1 << (bit % 8);
+  }
+
+  unsigned char crc = 0;
+  for( int b=0; b<n-1; b++ )
+    crc = settingsCrc( crc, buffer[b] );
+  buffer[n-1] = crc;
+  return n;
+}
+
+
+/**
+ * settingsRestore
+ *
+ * Sets the current values of the settings of 'menu' to the values in the
+ * snapshot in 'buffer'.
+ */
+bool settingsRestore( const unsigned char *buffer, int size, SettingsMenu *menu ) {
+  int n = settingsSnapshotSize( menu );
+  if( buffer == NULL || size < n )
+    return false;
+  unsigned char crc = 0;
+  for( int b=0; b<n-1; b++ )
+    crc = settingsCrc( crc, buffer[b] );
+  unsigned long schema = snapshotSchema( menu );
+  for( int b=0; b<SNAPSHOT_HEADER; b++ )
+    if( buffer[b] != (unsigned char)(schema >> (8 * b)) )
+      return false;
+  if( crc != buffer[n-1] )
+    return false;
+
+  int bit = SNAPSHOT_HEADER * 8;
+  for( int i=0; i<menu->count(); i++ ) {
+    Setting *setting = menu->setting( i );
+    int bits = snapshotBits( setting );
+    int value = 0;
+    for( int b=0; b<bits; b++, bit++ )
+      if( buffer[bit / 8] & (1 << (bit % 8)) )
+        value |= 1 << b;
+    if( setting->name == NULL || value >= setting->nValues )
+      continue;
+    setting->currentValue = value;
+    setting->newValue = value;
+  }
+  return true;
+}
@@ -0,0 +1,225 @@
+/*
+ * Persistent storage of the current values of the settings, in EEPROM or
+ * (for tests on a host computer) in a file.
+ *
+ * The values are stored in a journal: an accepted change of a value (see
+ * settingsOK()) appends a small record. Changes are collected and only written
+ * by poll() when no value has been changed for a while, or when the menu is
+ * no longer displayed, so a setting which is changed several times is written
+ * once. The storage is divided in two
+ * banks. When the active bank is full, the other bank is erased, all current
+ * values are written into it and only then its header is written, which
+ * makes it the active bank. poll() writes the new bank one record at a time,
+ * while the old bank stays active. This spreads the writes over the whole storage,
+ * and power loss during a write loses at most the record being written: a
+ * record or header which has not been completely written does not match its
+ * crc, and is ignored.
+ *
+ * Bank:     header, record, record, ...
+ * Header:   'S', 'J', version, generation[4], crc
+ *           The active bank is the valid bank with the highest generation.
+ * Record:   name[4], value[4], crc
+ *           settingsHash() of the name of the setting and of its value, so
+ *           stored values stay valid when settings or values are added or
+ *           moved. The crc includes the generation of the bank, so records
+ *           left over from an older generation are never taken for new ones.
+ */
+
+
+#ifndef _settings_store_h_
+#define _settings_store_h_
+
+#include "settings.h"
+
+#define STORE_VERSION 2
+#define STORE_HEADER 8      // size of a bank header
+#define STORE_RECORD 9      // size of a record
+#define STORE_ERASED 0xFF   // value of an erased byte
+
+// Time in milliseconds without changes after which changes are written
+#ifndef STORE_QUIET
+#define STORE_QUIET 2000
+#endif
+
+/*
+ * Where the journal is kept. Addresses start at 0.
+ */
+class SettingsStorage {
+public:
+  virtual int size() = 0;
+  virtual bool read( int address, unsigned char *data, int n ) = 0;
+  virtual bool write( int address, const unsigned char *data, int n ) = 0;
+};
+
+#ifdef ARDUINO
+/*
+ * Storage in (a part of) the EEPROM.
+ */
+class SettingsEEPROM : public SettingsStorage {
+public:
+  /**
+   * Parameters:
+   * start:     first address in the EEPROM to use
+   * n:         number of bytes to use
+   */
+  SettingsEEPROM( int start, int n );
+  int size();
+  bool read( int address, unsigned char *data, int n );
+  bool write( int address, const unsigned char *data, int n );
+private:
+  int start;
+  int n;
+};
+#else
+/*
+ * Storage in a file, to emulate the EEPROM on a host computer.
+ */
+class SettingsFileStorage : public SettingsStorage {
+public:
+  /**
+   * Parameters:
+   * path:      the file. It will be created (erased) if it does not exist.
+   * n:         number of bytes to use
+   */
+  SettingsFileStorage( const char *path, int n );
+  ~SettingsFileStorage();
+  int size();
+  bool read( int address, unsigned char *data, int n );
+  bool write( int address, const unsigned char *data, int n );
+private:
+  void *file;
+  int n;
+};
+#endif
+
+class SettingsStore {
+public:
+  SettingsStore();
+
+  /**
+   * Call to initialise the storage of the values, after all settings have
+   * been created. After this, every accepted change of a value in 'menu' is
+   * written to 'storage' by poll().
+   *
+   * Parameters:
+   * storage:   Where the values are kept. It must have room for at least
+   *            twice the number of settings in records, plus two headers.
+   * menu:      The menu with the settings.
+   *
+   * init() may be called again, e.g. after the storage has been erased.
+   */
+  bool init( SettingsStorage *storage, SettingsMenu *menu = &settingsMenu );
+
+  /**
+   * Sets the current values of the settings to the stored values. This does
+   * not call the ChangeSettingFDef of the settings. Call this after all
+   * settings have been created. Stored settings or values which are not in
+   * the menu anymore are skipped.
+   *
+   * Return:
+   * false if there are no stored values
+   */
+  bool restore();
+
+  /**
+   * Writes the current value of setting 'i' now. When the active bank is
+   * full, this starts a new bank instead, which gets the value and is
+   * written by poll() or flush().
+   */
+  bool save( int i );
+
+  /**
+   * Writes the changed values, when no value has been changed for the quiet
+   * period or when the menu is not displayed. Writes at most one record per
+   * call, also while a new bank is written, so it can be called from loop()
+   * without delaying the input. A value is no longer marked as changed once
+   * it has been written.
+   */
+  bool poll();
+
+  /**
+   * Writes all changed values now, and completes a new bank.
+   */
+  bool flush();
+
+  /**
+   * Sets the time in milliseconds without changes after which poll() writes
+   * the changes. The default is STORE_QUIET.
+   */
+  bool setQuiet( unsigned long quiet );
+
+private:
+  SettingsStorage *storage;
+  SettingsMenu *menu;
+  unsigned char *dirty;       // per setting, 1 if its value must be written
+  int nDirty;                 // number of settings in 'dirty'
+  int nChanged;               // number of settings with a value to write
+  int nextDirty;              // where poll() continues looking for a changed value
+  unsigned long lastChange;   // millis() of the last change
+  unsigned long quiet;
+  int bankSize;
+  int bank;                   // the active bank, -1 if there is none
+  unsigned long generation;   // generation of the active bank
+  int next;                   // address in the active bank for the next record
+  bool switching;             // the other bank is being written
+  int erased;                 // number of bytes of the other bank which have been erased
+  int copied;                 // number of settings which have been copied into the other bank
+  int switchNext;             // address in the other bank for the next record
+
+  static void listener( void *context, const SettingsChange *change );
+  bool readHeader( int bank, unsigned long *generation );
+  bool readRecord( int address, unsigned long *name, unsigned long *value );
+  bool writeRecord( int address, Setting *setting, unsigned long generation );
+  bool startSwitch();
+  bool switchStep();
+  bool writeNext();
+};
+
+/**
+ * Writes all changed values of the first store which has been initialised.
+ */
+bool settingsFlush();
+
+/*
+ * A snapshot holds the current values of all settings of a menu in a few
+ * bytes, e.g. to keep them in a single EEPROM page and restore them quickly
+ * at boot:
+ *
+ * Snapshot:  schema[4], values, crc
+ *            The schema is a hash of the names and numbers of values of the
+ *            settings, so a snapshot is only restored into the same menu.
+ *            Each value takes ceil(log2(nValues)) bits, the lowest bit first.
+ */
+#define SNAPSHOT_HEADER 4
+
+/**
+ * settingsSnapshotSize
+ *
+ * Return:
+ * The number of bytes needed for a snapshot of 'menu'.
+ */
+int settingsSnapshotSize( SettingsMenu *menu = &settingsMenu );
+
+/**
+ * settingsSnapshot
+ *
+ * Writes a snapshot of the current values of 'menu' into 'buffer'.
+ *
+ * Return:
+ * The number of bytes written, or -1 if 'size' is too small.
+ */
+int settingsSnapshot( unsigned char *buffer, int size, SettingsMenu *menu = &settingsMenu );
+
+/**
+ * settingsRestore
+ *
+ * Sets the current values of the settings of 'menu' to the values in the
+ * snapshot in 'buffer'. Like SettingsStore::restore() this does not call the
+ * ChangeSettingFDef of the settings.
+ *
+ * Return:
+ * false if the snapshot is not valid, or not of this menu
+ */
+bool settingsRestore( const unsigned char *buffer, int size, SettingsMenu *menu = &settingsMenu );
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Host test of the drawing code. Each test runs a scripted sequence of calls
+ * on a menu and compares the screen model (see SETTINGS_SCREEN in settings.h)
+ * with a golden screen in golden/<name>.txt, in the format of
+ * settingsScreenDump(). The lines which differ are printed.
+ *
+ * Usage:
+ * screens <golden dir>        run the tests
+ * screens -u <golden dir>     write the golden screens from the current code;
+ *                             check them by hand before committing them
+ */
+
+#include <settings.h>
+#include <settings_knob.h>
+
+Stream Serial;
+
+bool update = false;
+const char *goldenDir = "golden";
+int failures = 0;
+
+char *values[] = { "alpha", "beta", "gamma" };
+char names[20][8];
+int temperature = 10;
+
+
+bool change( Setting *setting ) {
+  return true;
+}
+
+
+bool temperatureText( Setting *setting, char *text, int size ) {
+  snprintf( text, size, "%d", temperature );
+  return true;
+}
+
+
+/**
+ * Writes the screen model to a file.
+ */
+class FilePrint : public Print {
+public:
+  FilePrint( FILE *file ) { this->file = file; }
+  size_t write( uint8_t c ) { return fputc( c, file ) == EOF ? 0 : 1; }
+private:
+  FILE *file;
+};
+
+
+/**
+ * Compares the screen model of 'menu' with golden/<name>.txt, or writes it
+ * there in update mode. A screen which is expected more than once is only
+ * written the first time.
+ */
+void screen( SettingsMenu *menu, const char *name ) {
+  static const char *written[32];
+  static int nWritten = 0;
+  bool first = true;
+  for( int w=0; w<nWritten; w++ )
+    first = first && strcmp( written[w], name ) != 0;
+  char path[256];
+  snprintf( path, sizeof( path ), "%s/%s.txt", goldenDir, name );
+  if( update && first && nWritten < 32 ) {
+    written[nWritten++] = name;
+    FILE *file = fopen( path, "w" );
+    if( file == NULL ) {
+      printf( "FAIL %s: cannot write %s\n", name, path );
+      failures++;
+      return;
+    }
+    FilePrint out( file );
+    menu->screenDump( &out );
+    fclose( file );
+    printf( "wrote %s\n", path );
+    return;
+  }
+
+  static char lines[TFT_LINES][SCREEN_LINE_LENGTH + 2];
+  const char *expected[TFT_LINES];
+  FILE *file = fopen( path, "r" );
+  if( file == NULL ) {
+    printf( "FAIL %s: no %s\n", name, path );
+    failures++;
+    return;
+  }
+  for( int row=0; row<TFT_LINES; row++ ) {
+    if( fgets( lines[row], sizeof( lines[row] ), file ) == NULL )
+      lines[row][0] = '\0';
+    lines[row][strcspn( lines[row], "\r\n" )] = '\0';
+    expected[row] = lines[row];
+  }
+  fclose( file );
+
+  printf( "%s\n", name );
+  int differences = menu->screenCompare( expected, &Serial );
+  if( differences > 0 ) {
+    printf( "FAIL %s: %d differences\n", name, differences );
+    failures++;
+  }
+}
+
+
+/**
+ * A menu of 20 settings, on the whole display.
+ */
+void createMenu( SettingsMenu *menu, ST7735_t3 *tft ) {
+  menu->init( 20, tft );
+  for( int i=0; i<20; i++ ) {
+    snprintf( names[i], sizeof( names[i] ), "S%d", i );
+    menu->createSetting( names[i], values, 3, i % 3, false, change );
+  }
+}
+
+
+/**
+ * Scrolling down, and a value being edited.
+ */
+void testMenu() {
+  ST7735_t3 tft;
+  SettingsMenu menu;
+  createMenu( &menu, &tft );
+  menu.displayOn();
+  screen( &menu, "menu" );
+  for( int i=0; i<17; i++ )
+    menu.up();
+  menu.ok();
+  menu.down();
+  screen( &menu, "menu_edit" );
+
+  // the application used a part of the display
+  menu.displayOff();
+  menu.displayResume( 10, 20, 40, 17 );
+  screen( &menu, "menu_edit" );
+}
+
+
+/**
+ * A menu in the bottom 6 lines of the display.
+ */
+void testWindow() {
+  ST7735_t3 tft;
+  SettingsMenu menu;
+  createMenu( &menu, &tft );
+  menu.window( 3, 10, 16, 6 );
+  menu.displayOn();
+  for( int i=0; i<8; i++ )
+    menu.up();
+  screen( &menu, "window" );
+
+  menu.displayOff();
+  menu.displayResume( 0, 0, TFT_WIDTH, 11 * CHAR_HEIGHT );
+  screen( &menu, "window" );
+}
+
+
+/**
+ * Editing one setting on a line of the display while the menu is off.
+ */
+void testQuickEdit() {
+  ST7735_t3 tft;
+  SettingsMenu menu;
+  createMenu( &menu, &tft );
+  menu.displayOn();
+  menu.displayOff();
+  menu.quickEdit( menu.setting( 1 ), 14, NULL );
+  menu.up();
+  screen( &menu, "quick_edit" );
+
+  menu.ok();
+  menu.displayResume( 0, 14 * CHAR_HEIGHT, TFT_WIDTH, CHAR_HEIGHT );
+  screen( &menu, "quick_edit_end" );
+}
+
+
+/**
+ * A menu with a telemetry value, of 10.
+ */
+void createTelemetryMenu( SettingsMenu *menu, ST7735_t3 *tft ) {
+  menu->init( 4, tft );
+  menu->createSetting( "Volume", values, 3, 0, false, change );
+  menu->createSetting( "Band", values, 3, 1, false, change );
+  menu->createTelemetry( "Temp", temperatureText );
+  menu->telemetryInterval( 0 );
+  temperature = 10;
+}
+
+
+/**
+ * A telemetry value which changes while the menu is off.
+ */
+void testTelemetry() {
+  ST7735_t3 tft;
+  SettingsMenu menu;
+  createTelemetryMenu( &menu, &tft );
+  menu.displayOn();
+  menu.pollTelemetry();
+  menu.displayOff();
+  temperature = 42;
+  menu.pollTelemetry();
+  menu.displayResume( 0, 0, 0, 0 );
+  screen( &menu, "telemetry" );
+}
+
+
+/**
+ * A telemetry value which changes while the menu is off, on a line which
+ * the application has only partly used.
+ */
+void testTelemetryPartlyCovered() {
+  ST7735_t3 tft;
+  SettingsMenu menu;
+  createTelemetryMenu( &menu, &tft );
+  menu.displayOn();
+  menu.pollTelemetry();
+  menu.displayOff();
+  temperature = 42;
+  menu.pollTelemetry();
+  menu.displayResume( 0, 2 * CHAR_HEIGHT, 6 * CHAR_WIDTH, CHAR_HEIGHT );
+  screen( &menu, "telemetry" );
+}
+
+
+/**
+ * Values which change while one setting is edited on a single line.
+ */
+void testQuickEditChanges() {
+  ST7735_t3 tft;
+  SettingsMenu menu;
+  createTelemetryMenu( &menu, &tft );
+  menu.displayOn();
+  menu.pollTelemetry();
+  menu.displayOff();
+  menu.quickEdit( menu.setting( 0 ), 10, NULL );
+  temperature = 42;
+  menu.pollTelemetry();
+  menu.setValue( 1, 2 );
+  menu.up();
+  screen( &menu, "quick_edit_changes" );
+
+  menu.ok();
+  menu.displayResume( 0, 10 * CHAR_HEIGHT, TFT_WIDTH, CHAR_HEIGHT );
+  screen( &menu, "quick_edit_changes_end" );
+}
+
+
+/**
+ * A knob indicator which follows a value set by the application.
+ */
+void testKnobFollows() {
+  ST7735_t3 tft;
+  SettingsMenu menu;
+  createTelemetryMenu( &menu, &tft );
+  SettingsKnob knob;
+  knob.init( menu.setting( 0 ), &menu );
+  knob.setIndicator( 12 );
+  knob.turn( 1 );
+  knob.poll();
+  delay( KNOB_SETTLE );
+  knob.poll();
+  menu.setValue( 0, 2 );
+  knob.poll();
+  screen( &menu, "knob_follows" );
+}
+
+
+int main( int argc, char **argv ) {
+  for( int a=1; a<argc; a++ ) {
+    if( strcmp( argv[a], "-u" ) == 0 )
+      update = true;
+    else
+      goldenDir = argv[a];
+  }
+  testMenu();
+  testWindow();
+  testQuickEdit();
+  testTelemetry();
+  testTelemetryPartlyCovered();
+  testQuickEditChanges();
+  testKnobFollows();
+  if( failures == 0 )
+    printf( "all screens equal\n" );
+  else
+    printf( "%d screens differ\n", failures );
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+/*
+ * Empty, the stub of ST7735_t3 has the drawing functions.
+ */
@@ -0,0 +1,68 @@
+/*
+ * Just enough of the Arduino core to build the library on a host computer,
+ * for the tests in test/.
+ */
+
+#ifndef _Arduino_h_
+#define _Arduino_h_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+inline unsigned long micros() {
+  timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec * 1000000UL + t.tv_nsec / 1000;
+}
+
+inline unsigned long millis() {
+  return micros() / 1000;
+}
+
+inline void delay( unsigned long ms ) {
+  usleep( ms * 1000 );
+}
+
+inline void noInterrupts() {
+}
+
+inline void interrupts() {
+}
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write( uint8_t c ) = 0;
+  virtual size_t write( const uint8_t *buffer, size_t n ) {
+    size_t result = 0;
+    while( n-- > 0 )
+      result += write( *buffer++ );
+    return result;
+  }
+  virtual int availableForWrite() { return 64; }
+  size_t print( const char *text ) { return write( (const uint8_t *) text, strlen( text ) ); }
+  size_t print( char c ) { return write( (uint8_t) c ); }
+  size_t print( long value ) { char text[24]; snprintf( text, sizeof( text ), "%ld", value ); return print( text ); }
+  size_t print( unsigned long value ) { char text[24]; snprintf( text, sizeof( text ), "%lu", value ); return print( text ); }
+  size_t print( int value ) { return print( (long) value ); }
+  size_t print( unsigned int value ) { return print( (unsigned long) value ); }
+  size_t println() { return print( '\n' ); }
+  template<class T> size_t println( T value ) { size_t n = print( value ); return n + println(); }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual size_t write( uint8_t c ) { return fputc( c, stdout ) == EOF ? 0 : 1; }
+  void begin( long baud ) {}
+};
+
+extern Stream Serial;
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * A display which draws nothing, to build the library on a host computer.
+ * The screen model of SETTINGS_SCREEN records what the library draws.
+ */
+
+#ifndef _ST7735_t3_h_
+#define _ST7735_t3_h_
+
+#include <Arduino.h>
+
+#define ST7735_BLACK 0x0000
+#define INITR_BLACKTAB 0
+
+class ST7735_t3 : public Print {
+public:
+  ST7735_t3() {}
+  ST7735_t3( uint8_t cs, uint8_t rs, uint8_t rst ) {}
+  void initR( uint8_t options ) {}
+  void fillScreen( uint16_t color ) {}
+  void fillRect( int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color ) {}
+  void setCursor( int16_t x, int16_t y ) {}
+  void setTextColor( uint16_t color ) {}
+  void setTextColor( uint16_t color, uint16_t background ) {}
+  size_t write( uint8_t c ) { return 1; }
+};
+
+#endif